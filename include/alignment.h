@@ -0,0 +1,86 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+#include "types.h"
+
+// Maps positions in the audio the recognizer was fed onto positions in the
+// input audio. They drift apart because voice activity detection leaves out
+// silence, and endpoints insert padding. Both are 16 kHz sample counts.
+// Written by the capture thread and read by the inference thread.
+class TimeMap {
+public:
+  // Record that `length` samples starting at `recognizer_sample` came from the
+  // input starting at `input_sample`
+  void add(u64 recognizer_sample, u64 input_sample, u64 length);
+  u64 to_input(u64 recognizer_sample);
+
+private:
+  std::mutex m_mutex;
+
+  // One entry per contiguous run, sorted by both columns
+  std::vector<u64> m_recognizer_start;
+  std::vector<u64> m_input_start;
+  u64 m_recognizer_end = 0;
+  u64 m_input_end = 0;
+};
+
+// A run of committed lines, or of their tokens, stored as parallel arrays so
+// multi-hour sessions stay small. Never modified once published, so a chunk that
+// didn't change is shared between snapshots
+struct AlignmentLines {
+  std::vector<u64> start;
+  std::vector<u64> end;
+  std::vector<u32> first_token; // Index among all tokens, not just this chunk's
+};
+
+struct AlignmentTokens {
+  std::vector<u64> start;
+  std::vector<u32> offset; // In bytes, within the token's line
+};
+
+// Where every committed line and token sits in the recorded audio, so the
+// recording can be seeked to a word, or subtitles exported without running the
+// recognizer again. Binary searches go from time to token. Positions are sample
+// offsets at the recording's sample rate. Not thread safe: the writer publishes
+// copies as AlignmentSnapshotPtr for other threads to read. Lines and tokens are
+// stored in fixed size chunks, and adding a line only copies the partly filled
+// last ones, so a copy shares everything but those with the original.
+class AlignmentIndex {
+public:
+  static const size_t lines_per_chunk = 64;
+  static const size_t tokens_per_chunk = 512;
+
+  // Add a line with a start for each of its tokens, and the byte offset where
+  // each token starts in the line's text. Token starts are clamped so they
+  // never go backwards
+  void add_line(u64 start, u64 end, std::span<const u64> token_starts,
+                std::span<const u32> token_offsets);
+
+  size_t line_count() const;
+  size_t token_count() const;
+
+  u64 line_start(size_t line) const;
+  u64 line_end(size_t line) const;
+  size_t line_first_token(size_t line) const;
+  size_t line_token_count(size_t line) const;
+  size_t line_at(u64 sample) const;
+
+  u64 token_start(size_t token) const;
+  size_t token_line(size_t token) const;
+  size_t token_at(u64 sample) const;
+  size_t token_at_offset(size_t line, u32 byte_offset) const;
+
+private:
+  u32 token_offset(size_t token) const;
+
+  std::vector<std::shared_ptr<const AlignmentLines>> m_lines;
+  std::vector<std::shared_ptr<const AlignmentTokens>> m_tokens;
+  size_t m_line_count = 0;
+  size_t m_token_count = 0;
+};
+
+using AlignmentSnapshotPtr = std::shared_ptr<const AlignmentIndex>;
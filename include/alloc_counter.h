@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+
+// Number of heap allocations made so far by the calling thread. This is always 0
+// unless the build defines DIDACT_COUNT_ALLOCATIONS, which replaces the global
+// operator new with a counting version.
+std::uint64_t thread_allocation_count();
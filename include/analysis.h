@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+
+// Samples at or above this magnitude are counted as clipped. Converting the
+// largest 16-bit sample to float gives just under 1
+inline constexpr float clip_level = 0.999f;
+
+// Levels of one buffer of audio
+struct AudioLevels {
+  float rms;
+  float peak;      // Largest magnitude
+  size_t clipped;  // Samples at or above clip_level
+  float dc_offset; // Mean of the samples
+};
+
+using AnalysisFunction = AudioLevels (*)(const float* samples, size_t count);
+
+struct AnalysisKernel {
+  const char* name;
+  AnalysisFunction analyze;
+};
+
+// Computes every level in one pass, with the widest vector instructions the
+// CPU has. Chosen once at startup, so it's cheap enough for the audio callback
+AudioLevels analyze_audio(const float* samples, size_t count);
+const char* analysis_kernel_name();
+
+// Every kernel this CPU can run, scalar first, for benchmarking
+std::span<const AnalysisKernel> analysis_kernels();
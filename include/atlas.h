@@ -0,0 +1,117 @@
+#pragma once
+
+#include <SDL3/SDL.h>
+#include <cstdint>
+#include <vector>
+
+// Where a glyph's pixels are in the atlas. The glyph is only there as long as
+// its shelf has the same generation; see GlyphAtlas::use()
+struct Glyph {
+  SDL_FRect rect;
+  int page;
+  int shelf; // Negative for glyphs with no pixels, which are never evicted
+  std::uint32_t generation;
+};
+
+// Quads waiting to be drawn from one atlas page
+struct GlyphBatch {
+  std::vector<SDL_Vertex> vertices;
+  std::vector<int> indices;
+};
+
+// Glyphs of every font and size, packed into shared textures ("pages"). Each
+// page is cut into shelves: horizontal strips that glyphs of about the same
+// height are placed on left to right. Pages are added until they'd go over the
+// memory budget, after which the least recently used shelf is emptied for new
+// glyphs, or the least recently used page if no shelf is tall enough. Pages that
+// had to go over the budget are freed again once they go cold. Glyphs are drawn
+// into a copy of each page kept in memory, and the changed region is uploaded
+// by flush(). Recency is counted in frames, see end_frame().
+class GlyphAtlas {
+public:
+  static constexpr size_t default_memory_budget = 64 << 20;
+
+  // The budget is for textures. The copies in memory take as much again
+  explicit GlyphAtlas(SDL_Renderer* renderer,
+                      size_t memory_budget = default_memory_budget);
+  ~GlyphAtlas();
+
+  GlyphAtlas(const GlyphAtlas&) = delete;
+  GlyphAtlas& operator=(const GlyphAtlas&) = delete;
+
+  // Copy a rasterized glyph into the atlas
+  Glyph add(SDL_Surface* surface);
+
+  // Whether the glyph is still in the atlas. If it is, its shelf counts as used
+  // this frame, so it won't be evicted before the frame is drawn
+  bool use(const Glyph& glyph) {
+    if (glyph.shelf < 0)
+      return true;
+    Shelf& shelf = m_shelves[glyph.shelf];
+    if (shelf.generation != glyph.generation)
+      return false;
+    shelf.last_used = m_frame;
+    return true;
+  }
+
+  // Queue a glyph to be drawn with its top left corner at (x, y)
+  void draw(const Glyph& glyph, float x, float y);
+
+  // Upload new glyphs and draw everything queued, with one draw call per page.
+  // Does nothing if no glyphs are queued, so it's cheap to call between draws
+  void flush();
+
+  // Call once per frame, after the last flush()
+  void end_frame();
+
+  SDL_Renderer* renderer() { return m_renderer; }
+  size_t memory_used() { return m_memory_used; }
+  unsigned long long draw_calls() { return m_draw_calls; }
+  unsigned long long evictions() { return m_evictions; }
+
+private:
+  struct Page {
+    SDL_Texture* texture; // Null once the page is freed, until it's reused
+    SDL_Surface* surface;
+    int size; // Pages are square. Usually m_page_size, see add()
+    SDL_Rect dirty; // Empty when the texture is up to date
+    int shelves_end; // Where the next shelf would start
+  };
+
+  struct Shelf {
+    int page; // Negative once its page is reclaimed, until the slot is reused
+    int y;
+    int height;
+    int x; // Where the next glyph goes
+    unsigned long long last_used;
+    std::uint32_t generation; // Bumped when the shelf is emptied
+  };
+
+  static size_t page_bytes(int size) { return (size_t)size * size * 4; }
+  int find_shelf(int width, int height);
+  int add_shelf(int page, int height);
+  int add_page(int size);
+  unsigned long long page_last_used(int page);
+  void reclaim_page(int page);
+  void free_page(int page);
+  void evict(int shelf);
+  void mark_dirty(Page& page, SDL_Rect rect);
+  void upload();
+
+  SDL_Renderer* m_renderer;
+  size_t m_memory_budget;
+  int m_page_size;
+  int m_max_texture_size;
+  size_t m_memory_used = 0;
+
+  std::vector<Page> m_pages;
+  std::vector<Shelf> m_shelves;
+  std::vector<int> m_free_shelves; // Slots left by reclaimed pages
+  std::vector<GlyphBatch> m_batches; // One per page, reused every frame
+
+  unsigned long long m_frame = 1;
+  unsigned long long m_draw_calls = 0;
+  unsigned long long m_evictions = 0;
+  bool m_over_budget = false;
+  bool m_queued = false; // Some batch has glyphs in it
+};
@@ -3,43 +3,82 @@
 #include <functional>
 #include <miniaudio.h>
 #include <renamenoise.h>
+#include <memory>
+#include <span>
+#include <thread>
 
 #include "queue.h"
-
-using u64 = unsigned long long;
-using u32 = unsigned int;
+#include "types.h"
 
 // Callback to process audio samples supplied by miniaudio
 using AudioCallback = std::function<void(void*, float*, u32)>;
 
+// Where the audio comes from: the microphone, a file played back through the
+// speakers in real time, or a file decoded as fast as possible with no device
+enum class StreamMode { Capture, Playback, Offline };
+
+// Encodes captured audio to a WAV file on a background thread. The realtime
+// callback only copies frames into a lock-free buffer, which the writer drains
+// in large batches, so a slow disk can't stall capture.
+class RecordingWriter {
+public:
+  // `buffer_frames` is how much audio can be buffered before frames are dropped
+  RecordingWriter(const char* path, ma_format format, u32 channels, u32 sample_rate,
+                  u64 buffer_frames);
+  ~RecordingWriter();
+
+  void push_frames(float* frames, u64 num_frames);
+  u64 dropped_frames();
+
+private:
+  void write_loop(std::stop_token token);
+
+  u32 m_channels;
+  ma_encoder m_encoder;
+  SampleQueue m_buffer;
+  std::vector<float> m_batch;
+  std::jthread m_thread;
+};
+
 class AudioStream {
 public:
   // Either stream audio from a file, or capture audio from the microphone
   ~AudioStream();
-  AudioStream(const char* path, bool is_capture);
+  AudioStream(const char* path, StreamMode mode, u64 record_buffer_frames = 48000 * 4);
 
   u32 sample_rate();
+  u64 length_in_frames();
+  u64 dropped_recording_frames();
   void start(AudioCallback callback, void* user_data);
   std::vector<float> get_samples(std::stop_token token, int size);
+  bool get_samples(std::stop_token token, std::span<float> output);
   void queue_samples(const void* input, void* output, u64 num_samples);
+  u64 read_frames(std::span<float> output);
 
   void enable_resampler(u32 samplerate);
   std::vector<float> resample(float* samples, u64 length);
+  u64 resample(std::span<float> samples, std::span<float> output);
+  u64 resampled_size(u64 length);
 
 private:
-  ma_device_config init_device_codec(const char* path);
+  ma_device_config init_device_codec(const char* path, u64 record_buffer_frames);
 
   void* m_user_data;
   AudioCallback m_user_callback;
 
   bool m_resampling;
+  StreamMode m_mode;
   bool m_is_capture;
   bool m_started;
   SampleQueue m_samples;
 
+  ma_format m_format;
+  u32 m_channels;
+  u32 m_sample_rate;
+
   ma_device m_device;
   ma_device_config m_dev_cfg;
-  ma_encoder m_encoder;
+  std::unique_ptr<RecordingWriter> m_recorder;
   ma_decoder m_decoder;
   ma_data_converter m_converter;
 };
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audio.h"
+#include "speech.h"
+
+// Find the quietest point between `min` and `max` to cut the audio at, so that
+// words don't get split between two segments
+u64 find_quiet_cut(std::span<const float> samples, u64 min, u64 max, u32 sample_rate);
+
+// Transcribes a long recording by cutting it into segments at quiet points and
+// decoding the segments concurrently. Every segment gets a fresh denoiser,
+// resampler and recognizer stream, but they all share the one recognizer.
+class BatchTranscriber {
+public:
+  BatchTranscriber(SpeechToText& stt, u32 sample_rate, int num_workers,
+                   double segment_seconds = 30.0);
+
+  // Feed the decoded file in order. Blocks when the workers fall behind, so
+  // only a few segments are held in memory at a time
+  void push_samples(std::span<const float> samples);
+
+  // Wait for the workers to finish, then return every line in order
+  std::vector<std::string> finish();
+
+private:
+  struct Job {
+    size_t index;
+    std::vector<float> samples;
+  };
+
+  void dispatch(u64 length);
+  void worker_loop(std::stop_token token);
+  static void resample(ma_data_converter& converter, std::span<const float> input,
+                       std::vector<float>& output);
+
+  SpeechToText& m_stt;
+  u32 m_sample_rate;
+  u64 m_segment_length;
+  size_t m_max_pending;
+  ma_data_converter_config m_converter_config;
+
+  std::vector<float> m_pending;
+  size_t m_num_segments;
+
+  std::mutex m_mutex;
+  std::condition_variable_any m_have_jobs;
+  std::condition_variable_any m_have_space;
+  std::deque<Job> m_jobs;
+  std::vector<std::vector<std::string>> m_results;
+  bool m_finished;
+
+  std::vector<std::jthread> m_workers;
+};
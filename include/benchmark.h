@@ -0,0 +1,16 @@
+#pragma once
+
+#include "config.h"
+#include "speech.h"
+
+// Microbenchmarks run with `didact --benchmark <name>`, logging their results.
+// Throws if there's no benchmark with that name
+void run_benchmark(const char* name);
+
+// Benchmarks that decode `audio_path` with the speech model, run with
+// `didact --benchmark <name> <audio file>`. Throws if there's no such benchmark
+void run_model_benchmark(const char* name, ModelPaths paths, RecognizerConfig config,
+                         const char* audio_path);
+
+// Whether the benchmark called `name` needs the speech model and an audio file
+bool is_model_benchmark(const char* name);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Settings for the streaming recognizer, tunable per machine without
+// recompiling. They can be read from a config file of `key = value` lines, and
+// overridden with command line flags of the same name (`--threads 4`).
+struct RecognizerConfig {
+  int threads = 2;           // Intra-op threads used by each decode
+  std::string provider = "cpu";
+  std::string decoding_method = "modified_beam_search"; // or "greedy_search"
+  int max_active_paths = 4;  // Only used by modified_beam_search
+  bool int8 = false;         // Use the quantized *.int8.onnx model files
+  bool auto_tune = false;    // Benchmark a few settings at startup, keep the fastest
+  bool adaptive = true;      // Live capture falls back on cheaper decoding when behind
+
+  // Endpoint rules, in seconds (rule 3 is the maximum utterance length)
+  float rule1_min_trailing_silence = 2.4f;
+  float rule2_min_trailing_silence = 1.2f;
+  float rule3_min_utterance_length = 300.0f;
+};
+
+// Set a single option by name. Throws if the name or value is invalid
+void set_option(RecognizerConfig& config, std::string_view key, std::string_view value);
+
+// Read options from a file, one `key = value` per line. '#' starts a comment
+void load_config_file(RecognizerConfig& config, const char* path);
+
+// Try to consume the flag at argv[index] (and its value, if it takes one).
+// Returns false if it isn't a recognizer flag
+bool parse_config_flag(RecognizerConfig& config, int argc, char** argv, int& index);
+
+// Path of the int8 quantized variant of a model file (model.onnx -> model.int8.onnx)
+std::string int8_variant(const char* path);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Power spectrum of a real signal. The samples are packed into a complex FFT of
+// half the size, which runs in radix-4 passes (plus one radix-2 pass for odd
+// powers of two). Real and imaginary parts are kept in separate arrays so each
+// pass works on four butterflies at a time with SSE.
+class RealFft {
+public:
+  // The size must be a power of two, and at least 8
+  explicit RealFft(size_t size);
+
+  size_t size() const { return m_size; }
+
+  // `input` has size() samples, and `power` gets size() / 2 bins, from DC up to
+  // just below the Nyquist frequency
+  void power_spectrum(std::span<const float> input, std::span<float> power);
+
+private:
+  void transform();
+
+  size_t m_size;
+  std::vector<std::uint32_t> m_reverse; // Bit reversed index of each complex point
+
+  // W = e^(-2*pi*i*j / 2m) for the pass combining blocks of m points, at offset m - 1
+  std::vector<float> m_twiddle_real;
+  std::vector<float> m_twiddle_imag;
+
+  // e^(-2*pi*i*k / size), for taking the real spectrum apart from the complex one
+  std::vector<float> m_split_real;
+  std::vector<float> m_split_imag;
+
+  std::vector<float> m_real;
+  std::vector<float> m_imag;
+};
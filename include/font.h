@@ -1,40 +1,81 @@
 #pragma once
 
 #include <SDL3_ttf/SDL_ttf.h>
-#include <unordered_map>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "atlas.h"
 
 struct Vec2 {
   float x, y;
   Vec2 operator+(Vec2 b) { return {x + b.x, y + b.y}; }
 };
 
-struct Glyph {
-  SDL_FRect rect;
-  int texture_offset;
+// Glyphs by codepoint, for looking them up once per character drawn or
+// measured. The Basic Multilingual Plane is split into pages of 256 codepoints,
+// allocated when their first glyph is added, so a lookup there is two array
+// indexes. Codepoints above it (emoji, rarer scripts) go in an open addressing
+// hash table with linear probing.
+class GlyphTable {
+public:
+  const Glyph* find(unsigned int codepoint) const {
+    if (codepoint >= bmp_size)
+      return find_rare(codepoint);
+
+    const Glyph* page = m_pages[codepoint / page_size].get();
+    if (!page || page[codepoint % page_size].page < 0)
+      return nullptr;
+    return &page[codepoint % page_size];
+  }
+
+  void insert(unsigned int codepoint, Glyph glyph);
+
+private:
+  static constexpr unsigned int bmp_size = 0x10000;
+  static constexpr unsigned int page_size = 256;
+
+  // Codepoint 0 marks an empty slot, since it's never above the BMP
+  struct RareGlyph {
+    unsigned int codepoint;
+    Glyph glyph;
+  };
+
+  const Glyph* find_rare(unsigned int codepoint) const;
+  size_t rare_slot(unsigned int codepoint) const;
+
+  // Missing glyphs in a page have a negative page
+  std::unique_ptr<Glyph[]> m_pages[bmp_size / page_size];
+  std::vector<RareGlyph> m_rare; // The size is a power of two, at most half full
+  size_t m_rare_count = 0;
 };
 
+// One font at one size. Its glyphs are kept in a GlyphAtlas shared with every
+// other font and size, so a glyph is looked up by the font cache it came from
+// and its codepoint. The atlas may evict glyphs that haven't been drawn in a
+// while, in which case they're rasterized again the next time they're needed
 class FontCache {
 public:
+  FontCache(GlyphAtlas& atlas, const char* path, int size, SDL_Color color);
   ~FontCache();
-  void init(SDL_Renderer* renderer, const char* path, int size, SDL_Color color);
 
-  void render(std::string str, Vec2 position);
-  Vec2 text_size(std::string str);
+  FontCache(const FontCache&) = delete;
+  FontCache& operator=(const FontCache&) = delete;
 
-private:
-  Glyph get_glyph(unsigned int codepoint);
-  void create_new_texture();
+  // Text is queued up in the atlas and drawn by GlyphAtlas::flush()
+  void render(std::string_view str, Vec2 position);
+  Vec2 text_size(std::string_view str);
+  Vec2 text_size(std::string_view str, std::vector<float>& advances);
 
-  int m_row_height;
-  int m_x_offset;
-  int m_y_offset;
-  int m_texture_offset;
+  int size() { return m_size; }
 
-  std::unordered_map<unsigned int, Glyph> m_glyphs;
-  std::vector<SDL_Texture*> m_textures;
+private:
+  Glyph get_glyph(unsigned int codepoint);
+  Vec2 measure(std::string_view str, std::vector<float>* advances);
 
-  int m_texture_size;
+  GlyphTable m_glyphs;
+  GlyphAtlas& m_atlas;
+  int m_size;
   SDL_Color m_color;
   TTF_Font* m_font;
-  SDL_Renderer* m_renderer;
-};
\ No newline at end of file
+};
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <c-api.h> // sherpa-onnx
+
+#include <memory>
+
+using RecognizerHandle = std::shared_ptr<const SherpaOnnxOnlineRecognizer>;
+
+// Get a recognizer for `config`, reusing one that's already loaded with the same
+// model files and settings. The recognizer (and its copy of the weights) is
+// freed once the last handle to it is gone.
+RecognizerHandle acquire_recognizer(const SherpaOnnxOnlineRecognizerConfig& config);
+
+// Map a model file into memory and have the kernel read it in ahead of time, so
+// that loading it is served from the page cache
+void prefetch_model_file(const char* path);
+
+// Resident set size of the process in bytes, or 0 where it can't be measured
+size_t resident_memory();
+
+// Detached threads that load or run a model count themselves from before they
+// start until they're done with onnxruntime. Those can't be interrupted, so a
+// process exiting while any are left should end with std::quick_exit, before
+// static destructors pull things out from under them
+void begin_model_thread();
+void end_model_thread();
+int model_threads();
@@ -1,42 +1,145 @@
 #pragma once
 
-#include <condition_variable>
-#include <deque>
-#include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <span>
 #include <stop_token>
 #include <vector>
 
+// Assumed cache line size, used to keep the producer and consumer state apart
+constexpr std::size_t cache_line_size = 64;
+
+// Fixed capacity ring buffer with a single producer and a single consumer.
+// Pushing never blocks, locks or allocates, so it's safe to call from the
+// realtime audio callback. Popping blocks until enough samples are available.
 class SampleQueue {
 public:
-  // Push to the queue, which doesn't have a maximum size
+  // The capacity is rounded up to the next power of two
+  explicit SampleQueue(std::size_t capacity = 1 << 19) {
+    m_capacity = std::bit_ceil(std::max<std::size_t>(capacity, 2));
+    m_mask = m_capacity - 1;
+    m_data = std::make_unique<float[]>(m_capacity);
+  }
+
+  SampleQueue(const SampleQueue&) = delete;
+  SampleQueue& operator=(const SampleQueue&) = delete;
+
+  // Push to the queue. Samples that don't fit are dropped and counted as overflow
   void push_samples(float* samples, int num_samples) {
-    std::unique_lock<std::mutex> guard(m_mutex);
-    m_data.insert(m_data.end(), samples, samples + num_samples);
-    m_not_empty.notify_one();
+    std::uint64_t head = m_head.load(std::memory_order_relaxed);
+    std::uint64_t tail = m_tail.load(std::memory_order_acquire);
+    std::uint64_t space = m_capacity - (head - tail);
+    std::uint64_t count = std::min<std::uint64_t>(space, num_samples);
+
+    if (count < (std::uint64_t)num_samples) {
+      m_overflowed_samples.fetch_add(num_samples - count, std::memory_order_relaxed);
+      m_overflow_events.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Copy in at most two parts, since the write can wrap around the end
+    std::size_t start = head & m_mask;
+    std::size_t first = std::min<std::size_t>(count, m_capacity - start);
+    std::copy(samples, samples + first, m_data.get() + start);
+    std::copy(samples + first, samples + count, m_data.get());
+    m_head.store(head + count, std::memory_order_release);
+
+    // Only enters the kernel when the consumer is actually asleep
+    m_signal.fetch_add(1, std::memory_order_release);
+    m_signal.notify_one();
   }
 
-  bool is_empty() {
-    std::unique_lock<std::mutex> guard(m_mutex);
-    return m_data.empty();
-  };
+  bool is_empty() { return size() == 0; };
+
+  std::size_t size() {
+    std::uint64_t head = m_head.load(std::memory_order_acquire);
+    std::uint64_t tail = m_tail.load(std::memory_order_acquire);
+    return head - tail;
+  }
+
+  std::size_t capacity() { return m_capacity; }
+
+  // Number of samples dropped because the queue was full, and how often it happened
+  std::uint64_t overflowed_samples() {
+    return m_overflowed_samples.load(std::memory_order_relaxed);
+  }
+  std::uint64_t overflow_events() {
+    return m_overflow_events.load(std::memory_order_relaxed);
+  }
 
   // Wait until there are enough samples in the queue, then pop
   std::vector<float> pop_samples(int num_samples, std::stop_token token = {}) {
-    std::unique_lock<std::mutex> guard(m_mutex);
     std::vector<float> output(num_samples, 0);
+    pop_samples(output, token); // Whatever wasn't read before a stop stays zeroed
+    return output;
+  }
 
-    auto lambda = [&] { return num_samples <= m_data.size(); };
-    if (!m_not_empty.wait(guard, token, lambda))
-      return output; // Stopped waiting because a stop was requested
+  // Same as above, but fills a caller provided buffer instead of allocating one.
+  // Returns false if a stop was requested before the buffer could be filled.
+  // Requests larger than the capacity could never be readable all at once,
+  // so they're popped one capacity sized piece at a time
+  bool pop_samples(std::span<float> output, std::stop_token token = {}) {
+    while (!output.empty()) {
+      std::size_t count = std::min(output.size(), m_capacity);
+      if (!wait_for(count, token))
+        return false;
 
-    int size = std::min(num_samples, (int)m_data.size());
-    std::copy(m_data.begin(), m_data.begin() + size, output.begin());
-    m_data.erase(m_data.begin(), m_data.begin() + size);
-    return output;
+      read(output.data(), count);
+      output = output.subspan(count);
+    }
+    return true;
+  }
+
+  // Pop whatever is available, up to the size of `output`, without waiting.
+  // Returns the number of samples popped
+  std::size_t try_pop_samples(std::span<float> output) {
+    std::size_t count = std::min(size(), output.size());
+    read(output.data(), count);
+    return count;
   }
 
 private:
-  std::deque<float> m_data;
-  std::mutex m_mutex;
-  std::condition_variable_any m_not_empty;
+  // Block until `count` samples are readable. Returns false if a stop was requested
+  bool wait_for(std::size_t count, std::stop_token& token) {
+    // Wake the consumer up when a stop is requested
+    std::stop_callback on_stop(token, [this] {
+      m_signal.fetch_add(1, std::memory_order_release);
+      m_signal.notify_all();
+    });
+
+    while (size() < count) {
+      if (token.stop_requested())
+        return false;
+
+      std::uint32_t signal = m_signal.load(std::memory_order_acquire);
+      if (size() >= count || token.stop_requested())
+        continue;
+      m_signal.wait(signal, std::memory_order_acquire);
+    }
+    return true;
+  }
+
+  void read(float* output, std::size_t count) {
+    std::uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    std::size_t start = tail & m_mask;
+    std::size_t first = std::min<std::size_t>(count, m_capacity - start);
+    std::copy(m_data.get() + start, m_data.get() + start + first, output);
+    std::copy(m_data.get(), m_data.get() + (count - first), output + first);
+    m_tail.store(tail + count, std::memory_order_release);
+  }
+
+  std::unique_ptr<float[]> m_data;
+  std::size_t m_capacity;
+  std::size_t m_mask;
+
+  // Monotonic positions, written by the producer and consumer respectively
+  alignas(cache_line_size) std::atomic<std::uint64_t> m_head = 0;
+  alignas(cache_line_size) std::atomic<std::uint64_t> m_tail = 0;
+
+  // Bumped on every push (and on stop requests) so the consumer can sleep on it
+  alignas(cache_line_size) std::atomic<std::uint32_t> m_signal = 0;
+  std::atomic<std::uint64_t> m_overflowed_samples = 0;
+  std::atomic<std::uint64_t> m_overflow_events = 0;
 };
@@ -1,15 +1,21 @@
 #pragma once
 
 #include "font.h"
+#include "spectrogram.h"
+#include "text_cache.h"
 #include <clay.h>
 
 class Renderer {
 public:
-  Renderer(SDL_Window* window, float window_width, float window_height);
+  Renderer(SDL_Window* window, float window_width, float window_height,
+           size_t glyph_memory_budget = GlyphAtlas::default_memory_budget);
   ~Renderer();
 
   void render_layout(Clay_RenderCommandArray* commands);
   void render_rectangle(SDL_FRect rect, SDL_FColor color);
+  void render_spectrogram(const Spectrogram& spectrogram, SDL_FRect rect);
+  void render_text(std::string_view text, Vec2 position, std::uint16_t font_id = 0,
+                   std::uint16_t font_size = 0);
 
   void present();
   void clear(SDL_FColor color);
@@ -18,6 +24,24 @@ private:
   void render_round_rect(float x, float y, float w, float h, float radius,
                          SDL_FColor color);
 
-  FontCache m_font; // TODO: make this support multiple font sizes
+  FontCache& font(std::uint16_t font_id, std::uint16_t font_size);
+
+  struct LoadedFont {
+    std::uint16_t id;
+    std::uint16_t size;
+    std::unique_ptr<FontCache> cache;
+  };
+
+  // Created once the renderer is, and destroyed before it. The font caches
+  // refer to the atlas, so they're destroyed first
+  std::unique_ptr<GlyphAtlas> m_atlas;
+  std::vector<LoadedFont> m_fonts;
+  TextMeasureCache m_measured; // For Clay, which measures every text on every layout
   SDL_Renderer* m_renderer;
+
+  // Ring of spectrogram columns, the same as in Spectrogram but only the
+  // visible part. m_spectrogram_pixels is a CPU copy laid out like the texture
+  SDL_Texture* m_spectrogram_texture = nullptr;
+  std::vector<Uint32> m_spectrogram_pixels;
+  Uint64 m_spectrogram_uploaded = 0; // Columns uploaded so far
 };
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <c-api.h> // sherpa-onnx
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "audio.h"
+#include "speech.h"
+
+// The last minute or so of 16 kHz input audio, so that a finished utterance
+// can be cut out again once its endpoint is known. Written by the capture
+// thread and read by the inference thread.
+class AudioHistory {
+public:
+  explicit AudioHistory(size_t capacity = 16000 * 60);
+
+  void push(std::span<const float> samples);
+
+  // Copy the samples from `start` to `end` (counted since the first push) into
+  // `output`, stopping at the newest. Returns false if they're no longer kept
+  bool copy(u64 start, u64 end, std::vector<float>& output);
+
+private:
+  std::mutex m_mutex;
+  std::vector<float> m_samples;
+  u64 m_end = 0; // Samples pushed so far
+};
+
+// Called from the worker thread with the rescored text of a line
+using RescoreHandler = void (*)(void* user_data, size_t line, const char* text);
+
+struct RescoreJob {
+  size_t line;
+  std::vector<float> samples;
+};
+
+// Shared with the worker thread, so the rescorer can be destroyed without
+// waiting for the model to load or a decode to finish
+struct RescoreQueue {
+  std::mutex mutex;
+  std::condition_variable done;
+  std::deque<RescoreJob> jobs;
+  size_t capacity;
+  bool stopped = false;
+
+  RescoreHandler handler;
+  void* user_data;
+
+  u64 dropped = 0;
+  u64 rescored = 0;
+};
+
+// Runs finished utterances through a larger, non-streaming model for a more
+// accurate transcript. The worker runs at idle priority with a single thread,
+// so it only ever uses CPU time nothing else wants. When it can't keep up, the
+// oldest queued utterances are dropped and keep their streaming result. The
+// model paths are copied, so they only need to outlive the constructor call.
+class Rescorer {
+public:
+  Rescorer(ModelPaths offline_paths, RescoreHandler handler, void* user_data,
+           size_t capacity = 4);
+  ~Rescorer();
+
+  Rescorer(const Rescorer&) = delete;
+  Rescorer& operator=(const Rescorer&) = delete;
+
+  void submit(size_t line, std::vector<float> samples);
+  u64 dropped_jobs();
+  u64 rescored_lines();
+
+private:
+  std::shared_ptr<RescoreQueue> m_queue;
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Immutable tree node, shared between every rope (and snapshot) that has it
+struct RopeNode {
+  std::shared_ptr<const RopeNode> left;
+  std::shared_ptr<const RopeNode> right;
+  std::string text; // Only set on leaves
+
+  size_t bytes;
+  size_t codepoints;
+  size_t newlines;
+  int height; // 0 for leaves
+};
+
+using RopeNodePtr = std::shared_ptr<const RopeNode>;
+
+struct LineColumn {
+  size_t line;
+  size_t column; // In codepoints
+};
+
+// UTF-8 text stored as a balanced (AVL) tree of small chunks, for the notes
+// editor. Edits and line/column lookups are O(log n) in the length of the
+// text. Nodes are never modified, so copying a rope is an O(1) snapshot that
+// stays valid (and readable from another thread) while the original is edited.
+// Byte offsets that land inside a codepoint are moved back to its start.
+class Rope {
+public:
+  Rope() = default;
+  explicit Rope(std::string_view text);
+
+  size_t size() const;
+  size_t codepoint_count() const;
+  size_t line_count() const;
+  bool empty() const;
+
+  void insert(size_t offset, std::string_view text);
+  void erase(size_t offset, size_t length);
+  void append(std::string_view text);
+
+  char at(size_t offset) const;
+  std::string substr(size_t offset, size_t length) const;
+  std::string to_string() const;
+
+  size_t line_start(size_t line) const;
+  LineColumn position(size_t offset) const;
+  size_t offset(size_t line, size_t column) const;
+
+private:
+  RopeNodePtr m_root;
+};
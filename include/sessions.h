@@ -0,0 +1,93 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "speech.h"
+
+using SessionId = int;
+using Clock = std::chrono::steady_clock;
+
+struct SessionStats {
+  unsigned long long results;
+  double average_latency_ms; // From accepting audio to handing back its result
+  double max_latency_ms;
+};
+
+struct BatchStats {
+  unsigned long long batches;
+  unsigned long long streams_decoded;
+  size_t max_batch_size;
+  double average_batch_size;
+};
+
+// Runs many transcription sessions on one shared recognizer, so the model
+// weights are only in memory once. A scheduler thread gathers every stream
+// that has enough audio and decodes them together in a single batch. Only that
+// thread touches the streams, so feeding a session never waits for a decode,
+// and handlers are called with no locks held.
+class SessionScheduler {
+public:
+  SessionScheduler(SpeechToText& stt);
+  ~SessionScheduler();
+
+  SessionId open_session(TextHandler handler, void* user_data);
+  void close_session(SessionId id);
+
+  // NOTE: The samples must be 16 kHz and normalized to a range of [-1, 1]
+  void accept_samples(SessionId id, float* samples, int num_samples);
+
+  SessionStats session_stats(SessionId id);
+  BatchStats batch_stats();
+
+private:
+  struct Session {
+    // Guarded by mutex
+    std::mutex mutex;
+    std::vector<float> pending; // Accepted, not yet fed to the stream
+    bool closed;
+    bool waiting; // Audio was accepted since it was last fed to the stream
+    Clock::time_point waiting_since;
+    unsigned long long results;
+    double total_latency_ms;
+    double max_latency_ms;
+
+    // Only touched by the scheduler thread once the session is open
+    const SherpaOnnxOnlineStream* stream;
+    std::vector<float> feeding; // Swapped with pending, to avoid allocating
+    bool measuring;             // Waiting for the result of audio fed at fed_since
+    Clock::time_point fed_since;
+    TextHandler handler;
+    void* user_data;
+  };
+
+  struct Result {
+    std::shared_ptr<Session> session;
+    std::string text;
+    bool endpoint;
+  };
+
+  std::shared_ptr<Session> get_session(SessionId id);
+  bool feed_stream(Session& session);
+  void run(std::stop_token token);
+
+  RecognizerHandle m_recognizer_handle; // Keeps the recognizer alive
+  const SherpaOnnxOnlineRecognizer* m_recognizer;
+
+  std::mutex m_mutex;
+  std::condition_variable_any m_have_audio;
+  std::vector<std::shared_ptr<Session>> m_sessions;
+  bool m_new_audio;
+
+  unsigned long long m_batches;
+  unsigned long long m_streams_decoded;
+  size_t m_max_batch_size;
+
+  std::jthread m_thread;
+};
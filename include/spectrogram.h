@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+#include "fft.h"
+#include "queue.h"
+
+// Scrolling spectrogram of the input, for diagnosing microphone problems (hum,
+// hiss, a dead channel) on site. The audio callback only copies samples into a
+// queue of its own. An analysis thread runs windowed FFTs over them and writes
+// each spectrum as a column of pixels into a ring, from which the render loop
+// uploads only the columns it hasn't seen yet. Like AmplitudeRing, readers
+// shouldn't look further back than half the ring, so the writer never
+// overwrites a column that's being read.
+class Spectrogram {
+public:
+  static constexpr size_t fft_size = 1024;
+  static constexpr size_t hop_size = 512;
+  static constexpr size_t height = 256; // Pixel rows, the highest frequency first
+  static constexpr size_t column_capacity = 1024;
+  static constexpr size_t visible_columns = column_capacity / 2;
+
+  explicit Spectrogram(std::uint32_t sample_rate);
+
+  Spectrogram(const Spectrogram&) = delete;
+  Spectrogram& operator=(const Spectrogram&) = delete;
+
+  void start();
+  void push_samples(float* samples, int num_samples); // From the audio callback
+
+  std::uint32_t sample_rate() const { return m_sample_rate; }
+  std::uint64_t columns_written() const {
+    return m_written.load(std::memory_order_acquire);
+  }
+
+  // `height` XRGB8888 pixels
+  const std::uint32_t* column(std::uint64_t index) const {
+    return &m_columns[(index % column_capacity) * height];
+  }
+
+private:
+  void run(std::stop_token token);
+  void write_column();
+
+  std::uint32_t m_sample_rate;
+  SampleQueue m_samples;
+  RealFft m_fft;
+
+  std::vector<float> m_hop;    // The newest samples
+  std::vector<float> m_window; // The last fft_size samples
+  std::vector<float> m_hann;
+  std::vector<float> m_windowed;
+  std::vector<float> m_power;
+  std::uint32_t m_palette[256];
+
+  std::unique_ptr<std::uint32_t[]> m_columns;
+  alignas(cache_line_size) std::atomic<std::uint64_t> m_written = 0;
+  std::jthread m_thread;
+};
@@ -3,14 +3,35 @@
 #include <c-api.h> // sherpa-onnx
 #include <renamenoise.h>
 
+#include "config.h"
+#include "model_cache.h"
+
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <functional>
+#include <memory>
 #include <mutex>
+#include <span>
 #include <stop_token>
 #include <string>
+#include <vector>
 
 using TextHandler = std::function<void(void*, std::string, bool)>;
 
+// How the current utterance's hypothesis changed since the last update. Only
+// sent when the tokens actually changed, or at an endpoint. The spans point
+// into the recognizer's result, so they're only valid during the callback
+struct TokenDelta {
+  size_t first_changed;                // Tokens before this index are unchanged
+  std::span<const char* const> tokens; // From first_changed on, "▁" starts a word
+  std::span<const float> timestamps;   // Start of each token, from start_time
+  double start_time; // Start of the utterance, in seconds of audio fed (see samples_fed)
+  bool endpoint;     // The utterance is complete
+};
+
+using DeltaHandler = void (*)(void* user_data, const TokenDelta& delta);
+
 struct ModelPaths {
   const char* tokens;
   const char* encoder;
@@ -18,27 +39,111 @@ struct ModelPaths {
   const char* joiner;
 };
 
+enum class ModelState { Idle, Loading, Ready, Failed, Cancelled };
+
+// Decoding settings, from most accurate to cheapest
+enum class DecodeMode { Configured, ReducedBeam, Greedy };
+
+const char* decode_mode_name(DecodeMode mode);
+
+// Recognizers for the cheaper decode modes, preloaded in the background once the
+// live stream is decoding, so falling back never has to build one while the CPU
+// is already behind. Shared with the preloading thread like ModelLoad
+struct DecodeModes {
+  std::mutex mutex;
+  std::vector<DecodeMode> modes;
+  std::vector<RecognizerConfig> configs;
+  std::vector<RecognizerHandle> recognizers; // Null until loaded, or if loading failed
+};
+
+// Shared between a SpeechToText and the thread loading its model, so the load
+// can be abandoned without waiting for it to finish
+struct ModelLoad {
+  std::mutex mutex;
+  std::condition_variable_any done;
+  ModelState state = ModelState::Idle;
+  std::atomic<float> progress = 0.0f;
+  std::atomic<bool> abandoned = false; // Also polled by the loaders without the lock
+
+  RecognizerConfig settings; // What was actually loaded
+  ReNameNoiseDenoiseState* denoiser = nullptr;
+  RecognizerHandle recognizer;
+  std::shared_ptr<DecodeModes> modes;
+  const SherpaOnnxOnlineStream* stream = nullptr;
+};
+
 class SpeechToText {
 public:
   ~SpeechToText();
-  SpeechToText(ModelPaths paths);
+  SpeechToText(ModelPaths paths, RecognizerConfig config = {});
 
   int expected_chunk_size();
   bool initialized();
+  void load();
+  void start_loading();
+  bool wait_until_loaded(std::stop_token token);
+  ModelState model_state();
+  float load_progress();
+  RecognizerHandle recognizer();
+  void set_num_threads(int num_threads);
+  RecognizerConfig config();
+  DecodeMode decode_mode();
 
-  void process(float* samples, int num_samples);
-  void run_inference(std::stop_token token, TextHandler handler, void* user_data);
+  void process(const float* samples, int num_samples);
+  void end_utterance();
+  unsigned long long samples_fed();
+  double decode_cost();
+  void run_inference(std::stop_token token, DeltaHandler handler, void* user_data);
+  void decode(DeltaHandler handler, void* user_data);
+  void finish(DeltaHandler handler, void* user_data);
+  void transcribe_segment(std::span<const float> samples,
+                          std::vector<std::string>& lines);
   std::vector<float> denoise(float* samples, int num_samples);
+  void denoise(std::span<float> samples, std::span<float> output);
 
 private:
-  void init();
+  bool adopt_model();
+  void start_preloading();
+  bool decode_ready(std::stop_token token, DeltaHandler handler, void* user_data);
+  void send_delta(const SherpaOnnxOnlineRecognizerResult* result, bool endpoint,
+                  DeltaHandler handler, void* user_data);
+  void track_load(double decode_seconds, double audio_seconds);
+  void adapt_decode_mode();
+  void switch_decode_mode(size_t index, const SherpaOnnxOnlineRecognizer* recognizer);
 
-  bool m_initialized;
+  std::atomic<bool> m_initialized;
+  std::shared_ptr<ModelLoad> m_load;
+  RecognizerConfig m_config;
   ModelPaths m_model_paths;
   std::mutex m_mutex;
   std::condition_variable_any m_have_enough_data;
+  bool m_force_endpoint;
+
+  // Tokens of the hypothesis last sent, reused between updates to avoid allocating
+  std::vector<std::string> m_tokens;
+  size_t m_token_count;
+
+  // Audio fed to the live stream, including padding, and how much of that went
+  // to streams replaced since. Gives times that carry on across mode switches
+  std::atomic<unsigned long long> m_samples_fed;
+  unsigned long long m_stream_offset;
+
+  // Used to measure how much CPU time a second of audio costs to decode
+  std::atomic<unsigned long long> m_accepted_samples;
+  std::atomic<unsigned long long> m_decode_nanoseconds;
+
+  // Used to pick the decode mode. Only touched with m_mutex held
+  std::shared_ptr<DecodeModes> m_modes;
+  size_t m_mode_index;
+  std::atomic<DecodeMode> m_mode;
+  double m_average_rtf;      // Smoothed decode time per second of audio
+  double m_backlog_seconds;  // Audio waiting to be decoded when the last pass started
+  unsigned long long m_undecoded_samples;
+  std::chrono::steady_clock::time_point m_last_switch;
+  bool m_preload_started;
 
   ReNameNoiseDenoiseState* m_denoiser;
+  RecognizerHandle m_recognizer_handle; // Possibly shared with other instances
   const SherpaOnnxOnlineRecognizer* m_recognizer;
   const SherpaOnnxOnlineStream* m_stream;
 };
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "font.h"
+
+// A measured run of text
+struct MeasuredText {
+  Vec2 size;
+  std::vector<float> advances; // Width of each codepoint
+};
+
+// Remembers the measurements of recently laid out text, so laying out the same
+// transcript again doesn't walk its glyphs. Keyed by the hash of the text and
+// the font and size it was measured with, and evicts the least recently used
+// runs once it's full.
+class TextMeasureCache {
+public:
+  explicit TextMeasureCache(size_t capacity = 4096);
+
+  // Measure `text` with `font`, unless it was measured recently
+  const MeasuredText& measure(FontCache& font, std::string_view text,
+                              std::uint16_t font_id, std::uint16_t font_size);
+
+private:
+  struct Key {
+    std::uint64_t hash;
+    std::uint16_t font_id;
+    std::uint16_t font_size;
+
+    bool operator==(const Key& other) const = default;
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& key) const {
+      return key.hash ^ ((std::uint64_t)key.font_id << 48) ^
+             ((std::uint64_t)key.font_size << 32);
+    }
+  };
+
+  struct Entry {
+    Key key;
+    std::string text; // To tell apart texts whose hashes collide
+    MeasuredText measured;
+  };
+
+  size_t m_capacity;
+  std::list<Entry> m_entries; // The most recently used first
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_index;
+};
@@ -1,32 +1,134 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <thread>
 
+#include "alignment.h"
+#include "analysis.h"
 #include "audio.h"
+#include "rescorer.h"
+#include "spectrogram.h"
+#include "transcript.h"
+#include "waveform.h"
 #include "speech.h"
+#include "vad.h"
+
+// Timing of an offline transcription. A real time factor below 1 means the
+// file was transcribed faster than it would take to play it back
+struct OfflineStats {
+  double audio_seconds;
+  double wall_seconds;
+  double real_time_factor;
+};
+
+// How much audio the voice activity detector kept away from the recognizer,
+// and roughly how much decoding time that saved
+struct VadStats {
+  double skipped_fraction;
+  double skipped_seconds;
+  double cpu_seconds_saved;
+};
+
+// Levels of the audio callbacks so far, for spotting a badly set up microphone
+struct InputStats {
+  float peak;
+  u64 clipped_samples;
+  float dc_offset;
+};
+
+struct RescoreStats {
+  u64 rescored_lines;
+  u64 dropped_lines; // Skipped because the worker couldn't keep up
+};
 
 class Transcriber {
 public:
-  Transcriber(ModelPaths paths, const char* audio_path, bool capture);
+  Transcriber(ModelPaths paths, const char* audio_path, StreamMode mode,
+              RecognizerConfig recognizer_config = {}, VadConfig vad_config = {});
   ~Transcriber();
 
+  void enable_rescoring(ModelPaths offline_paths);
   void start();
-  void update_transcript(std::string text, bool endpoint);
+  OfflineStats transcribe_offline();
+  OfflineStats transcribe_parallel(int num_workers);
+  void update_transcript(const TokenDelta& delta);
   void calculate_amplitude(float* samples, int num_samples);
   void process_audio_stream(std::stop_token token);
 
-  std::vector<std::string>& get_transcript();
-  std::vector<float> get_normalized_waveform();
+  TranscriptSnapshotPtr get_transcript();
+  AlignmentSnapshotPtr get_alignment();
+  WaveformView get_waveform(size_t count);
+  const WaveformPyramid& get_waveform_pyramid();
+  bool save_waveform_pyramid();
+  const Spectrogram& get_spectrogram();
+  u64 pipeline_allocations();
+  VadStats vad_stats();
+  InputStats input_stats();
+  RescoreStats rescore_stats();
+
+  ModelState model_state();
+  float model_load_progress();
+  RecognizerConfig recognizer_config();
+  DecodeMode decode_mode();
+  double time_to_first_transcript();
 
 private:
+  void prepare_pipeline();
+  void feed_recognizer(std::span<const float> samples);
+  void add_alignment();
+  void submit_rescore(u64 first_token, u64 last_token);
+  static void handle_delta(void* user_data, const TokenDelta& delta);
+  static void handle_rescore(void* user_data, size_t line, const char* text);
+
   std::string m_current_line;
-  std::vector<std::string> m_lines;
+  std::vector<u32> m_token_offsets; // Where each token starts in m_current_line
+  std::vector<double> m_token_times; // In seconds of audio fed to the recognizer
+  std::vector<u64> m_token_starts;   // Scratch space for converting them
+  Transcript m_transcript; // Published to the UI, see get_transcript()
+
+  // Lines that came from the live stream, and where they are in the audio. Only
+  // the inference thread touches m_alignment, and publishes a copy of it after
+  // every line for the UI. The copies share all but the last chunks with it
+  AlignmentIndex m_alignment;
+  std::atomic<AlignmentSnapshotPtr> m_published_alignment;
+  TimeMap m_time_map;
+  u64 m_input_samples; // 16 kHz samples given to the voice activity detector
+
+  // Optional second pass over finished lines, with the audio it needs
+  std::unique_ptr<AudioHistory> m_history;
+  std::unique_ptr<Rescorer> m_rescorer;
+  std::atomic<u64> m_rescore_dropped; // Audio was gone before they could be queued
 
-  // Circular buffer of amplitudes
-  std::vector<float> m_amp_buffer;
-  int m_write_offset;
-  int m_amp_buffer_size;
+  // Normalized amplitude of each audio callback, read in place by the UI
+  AmplitudeRing m_amplitudes;
   float m_max_amplitude;
+  std::atomic<float> m_input_peak;
+  std::atomic<u64> m_clipped_samples;
+  std::atomic<float> m_dc_offset;
+
+  // Summaries of the whole input for drawing it at any zoom, kept in a file next
+  // to the audio. Only built when that file couldn't be loaded
+  std::unique_ptr<WaveformPyramid> m_pyramid;
+  std::string m_pyramid_path;
+  bool m_pyramid_loaded;
+
+  // Analyzed on a thread of its own, away from the audio callback
+  std::unique_ptr<Spectrogram> m_spectrogram;
+
+  // Scratch buffers for the capture -> denoise -> resample pipeline, sized once
+  // in prepare_pipeline() so the steady state doesn't allocate
+  std::vector<float> m_frame;
+  std::vector<float> m_denoised;
+  std::vector<float> m_resampled;
+  std::atomic<u64> m_pipeline_allocations;
+  VoiceActivityDetector m_vad;
+
+  std::chrono::steady_clock::time_point m_created;
+  std::atomic<double> m_first_transcript_seconds;
 
   SpeechToText m_stt;
   std::jthread m_stt_thread;
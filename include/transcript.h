@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "rope.h"
+
+// A run of committed lines. Never modified once published, so a block that
+// didn't change is shared between snapshots
+struct LineBlock {
+  std::vector<std::string> lines;
+};
+
+using LineBlockPtr = std::shared_ptr<const LineBlock>;
+
+// The whole transcript at one point in time
+struct TranscriptSnapshot {
+  unsigned long long version = 0;
+  std::vector<LineBlockPtr> blocks;
+  size_t line_count = 0;
+  std::string current_line; // The utterance still being decoded
+  Rope document;            // The committed lines as text, one per line
+
+  const std::string& line(size_t index) const;
+
+  // Lines before the returned index are the same as in `older`. Only compares
+  // block pointers, so it's cheap however long the transcript gets
+  size_t first_changed_line(const TranscriptSnapshot& older) const;
+};
+
+using TranscriptSnapshotPtr = std::shared_ptr<const TranscriptSnapshot>;
+
+// Publishes the transcript from the threads producing it to the UI. Writers
+// build a new immutable snapshot next to the current one, copying only the
+// last, partly filled block (or the one with a replaced line), and swap it in
+// with an atomic pointer store. Readers take the latest one with an atomic
+// load, and never wait on a writer.
+class Transcript {
+public:
+  static const size_t block_size = 32;
+
+  Transcript();
+
+  TranscriptSnapshotPtr snapshot() const;
+
+  void set_current_line(std::string_view text);
+  void commit_line(std::string_view text); // Also clears the current line
+  void replace_line(size_t index, std::string_view text);
+  size_t line_count();
+
+private:
+  std::mutex m_writer_mutex; // Only taken by writers
+  std::atomic<TranscriptSnapshotPtr> m_published;
+};
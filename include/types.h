@@ -0,0 +1,4 @@
+#pragma once
+
+using u64 = unsigned long long;
+using u32 = unsigned int;
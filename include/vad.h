@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <span>
+#include <vector>
+
+struct VadConfig {
+  bool enabled = true;
+  float threshold_db = 9.0f;  // How far above the noise floor counts as speech
+  int pre_padding_ms = 300;   // Audio kept from before speech starts
+  int post_padding_ms = 600;  // Audio kept after speech stops
+};
+
+struct VadResult {
+  std::span<const float> samples; // What should be passed on to the recognizer
+  bool speech_ended;              // The gate just closed after a speech region
+};
+
+// Cheap voice activity detector based on frame energy relative to a tracked
+// noise floor, with the zero crossing rate used to catch quiet unvoiced sounds
+// like "s" and "f". It gates the audio so that only speech regions plus some
+// padding on either side reach the recognizer.
+class VoiceActivityDetector {
+public:
+  VoiceActivityDetector(VadConfig config, unsigned int sample_rate);
+
+  VadResult process(std::span<const float> frame);
+  bool is_speech(std::span<const float> frame);
+
+  unsigned long long total_samples();
+  unsigned long long forwarded_samples();
+  double skipped_fraction();
+
+private:
+  void remember(std::span<const float> frame);
+
+  VadConfig m_config;
+  unsigned int m_sample_rate;
+
+  float m_noise_floor_db;
+  bool m_open;
+  int m_hangover;     // Samples left before the gate closes
+  int m_post_padding; // In samples
+
+  // Circular buffer of the most recent audio, replayed when speech starts
+  std::vector<float> m_pre_roll;
+  size_t m_pre_roll_offset;
+  size_t m_pre_roll_size;
+  std::vector<float> m_output;
+
+  // Read from other threads for reporting
+  std::atomic<unsigned long long> m_total_samples;
+  std::atomic<unsigned long long> m_forwarded_samples;
+};
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <span>
+
+#include "queue.h"
+
+// The most recent amplitudes, oldest first, split in two where the ring wraps
+// around. Points straight into the ring, so nothing is copied
+struct WaveformView {
+  std::span<const float> first;
+  std::span<const float> second;
+
+  std::size_t size() const { return first.size() + second.size(); }
+  float operator[](std::size_t i) const {
+    return i < first.size() ? first[i] : second[i - first.size()];
+  }
+};
+
+// Fixed capacity history of amplitudes, written by the audio callback and read
+// in place by the render loop. The writer only ever touches the slot after the
+// newest one, and views are limited to half the capacity, so a view stays valid
+// until the writer laps half the ring. That's minutes of audio, and the render
+// loop is done with a view within the frame it took it in, so views must not be
+// kept any longer than that.
+class AmplitudeRing {
+public:
+  // The capacity is rounded up to the next power of two
+  explicit AmplitudeRing(std::size_t capacity = 1 << 16) {
+    m_capacity = std::bit_ceil(std::max<std::size_t>(capacity, 2));
+    m_mask = m_capacity - 1;
+    m_data = std::make_unique<float[]>(m_capacity);
+  }
+
+  AmplitudeRing(const AmplitudeRing&) = delete;
+  AmplitudeRing& operator=(const AmplitudeRing&) = delete;
+
+  void push(float amplitude) {
+    std::uint64_t written = m_written.load(std::memory_order_relaxed);
+    m_data[written & m_mask] = amplitude;
+    m_written.store(written + 1, std::memory_order_release);
+  }
+
+  // The last `count` amplitudes (or fewer, if not that many were written yet)
+  WaveformView view(std::size_t count) const {
+    std::uint64_t end = m_written.load(std::memory_order_acquire);
+    count = std::min<std::uint64_t>({count, end, max_view_size()});
+
+    std::size_t start = (end - count) & m_mask;
+    std::size_t first = std::min(count, m_capacity - start);
+    WaveformView view;
+    view.first = {m_data.get() + start, first};
+    view.second = {m_data.get(), count - first};
+    return view;
+  }
+
+  std::size_t max_view_size() const { return m_capacity / 2; }
+
+private:
+  std::size_t m_capacity;
+  std::size_t m_mask;
+  std::unique_ptr<float[]> m_data;
+  alignas(cache_line_size) std::atomic<std::uint64_t> m_written = 0;
+};
+
+// Min, max and RMS of a block of samples, quantized to 16 bits to keep long
+// recordings small
+struct WaveformBlock {
+  std::int16_t min;
+  std::int16_t max;
+  std::uint16_t rms;
+};
+
+// Append-only array of blocks, stored in fixed size chunks that never move, so
+// one thread can append while another reads the blocks published so far
+class WaveformLevel {
+public:
+  static constexpr std::size_t chunk_size = 4096;
+  static constexpr std::size_t max_chunks = 8192;
+
+  WaveformLevel();
+
+  void push(WaveformBlock block);
+  std::size_t size() const { return m_size.load(std::memory_order_acquire); }
+  const WaveformBlock& operator[](std::size_t i) const {
+    return m_chunks[i / chunk_size][i % chunk_size];
+  }
+
+private:
+  std::unique_ptr<std::unique_ptr<WaveformBlock[]>[]> m_chunks;
+  std::atomic<std::size_t> m_size = 0;
+};
+
+// Min/max/RMS summaries of a whole recording at every zoom level, like audio
+// editors use to draw waveforms. Level 0 summarizes blocks of `block_size`
+// samples, and every level above it pairs of blocks from the one below, so
+// drawing any stretch of the recording only reads about one block per column.
+// Built incrementally by one thread, readable from any other at the same time.
+class WaveformPyramid {
+public:
+  static constexpr std::size_t max_levels = 20;
+
+  explicit WaveformPyramid(std::uint32_t sample_rate, std::uint32_t block_size = 256);
+
+  WaveformPyramid(const WaveformPyramid&) = delete;
+  WaveformPyramid& operator=(const WaveformPyramid&) = delete;
+
+  void push_samples(std::span<const float> samples);
+
+  std::uint32_t sample_rate() const { return m_sample_rate; }
+  std::uint64_t sample_count() const;
+  const WaveformLevel& level(std::size_t index) const { return m_levels[index]; }
+
+  // Summarize the samples from `start` to `end` into one block per column
+  void summarize(std::uint64_t start, std::uint64_t end,
+                 std::span<WaveformBlock> columns) const;
+
+  // Store the finished blocks in a file (e.g. next to the WAV), or replace the
+  // pyramid with one that was stored. Loading fails if the file is missing, was
+  // made with a different sample rate or block size, or wasn't made from exactly
+  // `source_samples` samples (the length of the audio it should summarize)
+  bool save(const char* path) const;
+  bool load(const char* path, std::uint64_t source_samples);
+
+private:
+  void add_block(std::size_t level, WaveformBlock block);
+
+  std::uint32_t m_sample_rate;
+  std::uint32_t m_block_size;
+  std::unique_ptr<WaveformLevel[]> m_levels;
+  std::atomic<std::uint64_t> m_source_samples; // Pushed so far, whole blocks or not
+
+  // Writer only: the level 0 block being accumulated, and for every level a
+  // block waiting for its pair
+  float m_min, m_max;
+  double m_square_sum;
+  std::uint32_t m_pending_samples;
+  WaveformBlock m_unpaired[max_levels];
+  bool m_has_unpaired[max_levels];
+};
@@ -0,0 +1,153 @@
+#include <algorithm>
+
+#include "alignment.h"
+
+void TimeMap::add(u64 recognizer_sample, u64 input_sample, u64 length) {
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  // Extend the last run if this carries straight on from it
+  bool contiguous = !m_recognizer_start.empty() &&
+                    recognizer_sample == m_recognizer_end && input_sample == m_input_end;
+  if (!contiguous) {
+    m_recognizer_start.push_back(recognizer_sample);
+    m_input_start.push_back(input_sample);
+  }
+  m_recognizer_end = recognizer_sample + length;
+  m_input_end = input_sample + length;
+}
+
+u64 TimeMap::to_input(u64 recognizer_sample) {
+  std::lock_guard<std::mutex> guard(m_mutex);
+  if (m_recognizer_start.empty())
+    return recognizer_sample;
+
+  // The last run starting at or before the sample. Padding between runs maps
+  // onto the end of the run before it
+  auto it = std::upper_bound(m_recognizer_start.begin(), m_recognizer_start.end(),
+                             recognizer_sample);
+  size_t run = it == m_recognizer_start.begin() ? 0 : it - m_recognizer_start.begin() - 1;
+
+  u64 run_end = run + 1 < m_recognizer_start.size() ? m_recognizer_start[run + 1]
+                                                     : m_recognizer_end;
+  u64 offset = std::min(recognizer_sample, run_end) - m_recognizer_start[run];
+  if (run + 1 < m_input_start.size())
+    offset = std::min(offset, m_input_start[run + 1] - m_input_start[run]);
+  return m_input_start[run] + offset;
+}
+
+// Index of the last value at or before `value` in a sorted column that's split
+// over chunks, or 0 if there's none
+template <typename Chunk, typename T>
+static size_t last_at_or_before(const std::vector<std::shared_ptr<const Chunk>>& chunks,
+                                std::vector<T> Chunk::*column, size_t chunk_size,
+                                u64 value) {
+  auto chunk = std::upper_bound(
+      chunks.begin(), chunks.end(), value,
+      [&](u64 value, const auto& c) { return value < ((*c).*column).front(); });
+  if (chunk == chunks.begin())
+    return 0;
+
+  chunk--;
+  const std::vector<T>& values = (**chunk).*column;
+  auto it = std::upper_bound(values.begin(), values.end(), value);
+  return (chunk - chunks.begin()) * chunk_size + (it - values.begin()) - 1;
+}
+
+void AlignmentIndex::add_line(u64 start, u64 end, std::span<const u64> token_starts,
+                              std::span<const u32> token_offsets) {
+  // Start a new chunk, or copy the partly filled last one
+  std::shared_ptr<AlignmentLines> lines;
+  if (m_line_count % lines_per_chunk == 0) {
+    lines = std::make_shared<AlignmentLines>();
+    m_lines.emplace_back();
+  } else {
+    lines = std::make_shared<AlignmentLines>(*m_lines.back());
+  }
+  lines->start.push_back(start);
+  lines->end.push_back(std::max(start, end));
+  lines->first_token.push_back(m_token_count);
+  m_lines.back() = std::move(lines);
+  m_line_count++;
+
+  u64 previous = m_token_count == 0 ? 0 : token_start(m_token_count - 1);
+  std::shared_ptr<AlignmentTokens> tokens;
+  for (size_t i = 0; i < token_starts.size(); i++) {
+    if (m_token_count % tokens_per_chunk == 0) {
+      if (tokens)
+        m_tokens.back() = std::move(tokens);
+      tokens = std::make_shared<AlignmentTokens>();
+      m_tokens.emplace_back();
+    } else if (!tokens) {
+      tokens = std::make_shared<AlignmentTokens>(*m_tokens.back());
+    }
+
+    previous = std::max(previous, token_starts[i]);
+    tokens->start.push_back(previous);
+    tokens->offset.push_back(i < token_offsets.size() ? token_offsets[i] : 0);
+    m_token_count++;
+  }
+  if (tokens)
+    m_tokens.back() = std::move(tokens);
+}
+
+size_t AlignmentIndex::line_count() const { return m_line_count; }
+
+size_t AlignmentIndex::token_count() const { return m_token_count; }
+
+u64 AlignmentIndex::line_start(size_t line) const {
+  return m_lines[line / lines_per_chunk]->start[line % lines_per_chunk];
+}
+
+u64 AlignmentIndex::line_end(size_t line) const {
+  return m_lines[line / lines_per_chunk]->end[line % lines_per_chunk];
+}
+
+size_t AlignmentIndex::line_first_token(size_t line) const {
+  return m_lines[line / lines_per_chunk]->first_token[line % lines_per_chunk];
+}
+
+size_t AlignmentIndex::line_token_count(size_t line) const {
+  size_t end = line + 1 < m_line_count ? line_first_token(line + 1) : m_token_count;
+  return end - line_first_token(line);
+}
+
+// The last line starting at or before `sample`. NOTE: There must be at least one line
+size_t AlignmentIndex::line_at(u64 sample) const {
+  return last_at_or_before(m_lines, &AlignmentLines::start, lines_per_chunk, sample);
+}
+
+u64 AlignmentIndex::token_start(size_t token) const {
+  return m_tokens[token / tokens_per_chunk]->start[token % tokens_per_chunk];
+}
+
+u32 AlignmentIndex::token_offset(size_t token) const {
+  return m_tokens[token / tokens_per_chunk]->offset[token % tokens_per_chunk];
+}
+
+// Lines without tokens share their first token with the next line, so this picks
+// the last line with that first token, which is the one the token belongs to
+size_t AlignmentIndex::token_line(size_t token) const {
+  return last_at_or_before(m_lines, &AlignmentLines::first_token, lines_per_chunk,
+                           token);
+}
+
+// The last token starting at or before `sample`. NOTE: There must be at least one token
+size_t AlignmentIndex::token_at(u64 sample) const {
+  return last_at_or_before(m_tokens, &AlignmentTokens::start, tokens_per_chunk, sample);
+}
+
+// The token covering a byte of a line's text, e.g. the word that was clicked. A
+// line without tokens maps to the first token after it, or to the last one if
+// there's none after it. NOTE: There must be at least one token
+size_t AlignmentIndex::token_at_offset(size_t line, u32 byte_offset) const {
+  size_t first = line_first_token(line);
+  size_t end = first + line_token_count(line);
+  if (first == end)
+    return std::min(first, m_token_count - 1);
+
+  // Lines are a few dozen tokens at most
+  size_t token = first;
+  while (token + 1 < end && token_offset(token + 1) <= byte_offset)
+    token++;
+  return token;
+}
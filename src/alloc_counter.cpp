@@ -0,0 +1,26 @@
+#include "alloc_counter.h"
+
+#ifdef DIDACT_COUNT_ALLOCATIONS
+
+#include <cstdlib>
+#include <new>
+
+static thread_local std::uint64_t allocations = 0;
+
+void* operator new(std::size_t size) {
+  allocations++;
+  if (void* ptr = std::malloc(size == 0 ? 1 : size))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+std::uint64_t thread_allocation_count() { return allocations; }
+
+#else
+
+std::uint64_t thread_allocation_count() { return 0; }
+
+#endif
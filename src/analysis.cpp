@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "analysis.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DIDACT_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+// Sums for the samples a kernel handles one at a time, and for adding up the
+// lanes of the vector ones
+struct LevelSums {
+  float sum = 0;
+  float square_sum = 0;
+  float peak = 0;
+  size_t clipped = 0;
+
+  void add(float sample) {
+    float magnitude = std::fabs(sample);
+    sum += sample;
+    square_sum += sample * sample;
+    peak = std::max(peak, magnitude);
+    clipped += magnitude >= clip_level;
+  }
+
+  AudioLevels finish(size_t count) const {
+    if (count == 0)
+      return {0, 0, 0, 0};
+    return {std::sqrt(square_sum / count), peak, clipped, sum / count};
+  }
+};
+
+static AudioLevels analyze_scalar(const float* samples, size_t count) {
+  LevelSums sums;
+  for (size_t i = 0; i < count; i++)
+    sums.add(samples[i]);
+  return sums.finish(count);
+}
+
+#ifdef DIDACT_X86_KERNELS
+
+__attribute__((target("sse2"))) static AudioLevels analyze_sse2(const float* samples,
+                                                                size_t count) {
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  const __m128 clip = _mm_set1_ps(clip_level);
+  __m128 sum = _mm_setzero_ps();
+  __m128 square_sum = _mm_setzero_ps();
+  __m128 peak = _mm_setzero_ps();
+  __m128i clipped = _mm_setzero_si128();
+
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 x = _mm_loadu_ps(samples + i);
+    __m128 magnitude = _mm_andnot_ps(sign, x);
+    sum = _mm_add_ps(sum, x);
+    square_sum = _mm_add_ps(square_sum, _mm_mul_ps(x, x));
+    peak = _mm_max_ps(peak, magnitude);
+    // Comparisons give -1 in every lane that's true
+    clipped = _mm_sub_epi32(clipped, _mm_castps_si128(_mm_cmpge_ps(magnitude, clip)));
+  }
+
+  alignas(16) float sum_lanes[4], square_lanes[4], peak_lanes[4];
+  alignas(16) std::int32_t clipped_lanes[4];
+  _mm_store_ps(sum_lanes, sum);
+  _mm_store_ps(square_lanes, square_sum);
+  _mm_store_ps(peak_lanes, peak);
+  _mm_store_si128((__m128i*)clipped_lanes, clipped);
+
+  LevelSums sums;
+  for (int lane = 0; lane < 4; lane++) {
+    sums.sum += sum_lanes[lane];
+    sums.square_sum += square_lanes[lane];
+    sums.peak = std::max(sums.peak, peak_lanes[lane]);
+    sums.clipped += clipped_lanes[lane];
+  }
+  for (; i < count; i++)
+    sums.add(samples[i]);
+  return sums.finish(count);
+}
+
+__attribute__((target("avx2"))) static AudioLevels analyze_avx2(const float* samples,
+                                                                size_t count) {
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  const __m256 clip = _mm256_set1_ps(clip_level);
+  __m256 sum = _mm256_setzero_ps();
+  __m256 square_sum = _mm256_setzero_ps();
+  __m256 peak = _mm256_setzero_ps();
+  __m256i clipped = _mm256_setzero_si256();
+
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 x = _mm256_loadu_ps(samples + i);
+    __m256 magnitude = _mm256_andnot_ps(sign, x);
+    sum = _mm256_add_ps(sum, x);
+    square_sum = _mm256_add_ps(square_sum, _mm256_mul_ps(x, x));
+    peak = _mm256_max_ps(peak, magnitude);
+    __m256 is_clipped = _mm256_cmp_ps(magnitude, clip, _CMP_GE_OQ);
+    clipped = _mm256_sub_epi32(clipped, _mm256_castps_si256(is_clipped));
+  }
+
+  alignas(32) float sum_lanes[8], square_lanes[8], peak_lanes[8];
+  alignas(32) std::int32_t clipped_lanes[8];
+  _mm256_store_ps(sum_lanes, sum);
+  _mm256_store_ps(square_lanes, square_sum);
+  _mm256_store_ps(peak_lanes, peak);
+  _mm256_store_si256((__m256i*)clipped_lanes, clipped);
+
+  LevelSums sums;
+  for (int lane = 0; lane < 8; lane++) {
+    sums.sum += sum_lanes[lane];
+    sums.square_sum += square_lanes[lane];
+    sums.peak = std::max(sums.peak, peak_lanes[lane]);
+    sums.clipped += clipped_lanes[lane];
+  }
+  for (; i < count; i++)
+    sums.add(samples[i]);
+  return sums.finish(count);
+}
+
+#endif
+
+static std::span<const AnalysisKernel> find_kernels() {
+  static AnalysisKernel kernels[3];
+  size_t count = 0;
+  kernels[count++] = {"scalar", analyze_scalar};
+
+#ifdef DIDACT_X86_KERNELS
+  // Needed when this runs before main(), as it does here
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    kernels[count++] = {"SSE2", analyze_sse2};
+  if (__builtin_cpu_supports("avx2"))
+    kernels[count++] = {"AVX2", analyze_avx2};
+#endif
+
+  return {kernels, count};
+}
+
+// Picked at startup, so the audio callback never has to
+static const std::span<const AnalysisKernel> kernels = find_kernels();
+static const AnalysisKernel fastest = kernels.back();
+
+AudioLevels analyze_audio(const float* samples, size_t count) {
+  return fastest.analyze(samples, count);
+}
+
+const char* analysis_kernel_name() { return fastest.name; }
+
+std::span<const AnalysisKernel> analysis_kernels() { return kernels; }
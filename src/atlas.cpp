@@ -0,0 +1,365 @@
+#include <algorithm>
+
+#include "atlas.h"
+#include "error.h"
+
+// Shelf heights are rounded up to this, so glyphs of nearby sizes share shelves
+static const int shelf_granularity = 4;
+
+// Empty pixels around each glyph, so filtering never picks up a neighbour
+static const int glyph_padding = 1;
+
+// Frames a page over the budget has to go unused for before it's freed, so text
+// that comes and goes doesn't create and free a texture every frame
+static const unsigned long long cold_frames = 120;
+
+GlyphAtlas::GlyphAtlas(SDL_Renderer* renderer, size_t memory_budget)
+    : m_renderer(renderer), m_memory_budget(memory_budget) {
+  // Pages are as large as the GPU allows, up to 2048x2048 (16 MiB), but small
+  // enough that the budget fits at least one
+  SDL_PropertiesID props = SDL_GetRendererProperties(renderer);
+  m_max_texture_size =
+      SDL_GetNumberProperty(props, SDL_PROP_RENDERER_MAX_TEXTURE_SIZE_NUMBER, 0);
+  if (m_max_texture_size <= 0)
+    m_max_texture_size = 2048;
+  m_page_size = std::min(m_max_texture_size, 2048);
+  while (m_page_size > 256 && page_bytes(m_page_size) > m_memory_budget)
+    m_page_size /= 2;
+}
+
+GlyphAtlas::~GlyphAtlas() {
+  for (Page& page : m_pages) {
+    if (page.texture) {
+      SDL_DestroyTexture(page.texture);
+      SDL_DestroySurface(page.surface);
+    }
+  }
+}
+
+Glyph GlyphAtlas::add(SDL_Surface* surface) {
+  int width = surface->w + glyph_padding;
+  int height = surface->h + glyph_padding;
+  int size = std::max(width, height);
+  if (size > m_max_texture_size) {
+    SDL_Log("A %dx%d glyph is larger than the biggest texture the GPU supports, so "
+            "it won't be drawn",
+            surface->w, surface->h);
+    return {.rect = {0, 0, 0, 0}, .page = 0, .shelf = -1, .generation = 0};
+  }
+
+  // Huge text, or pages made small by a small budget. The glyph gets a page
+  // sized for it, which other glyphs share until end_frame() frees it for
+  // being over the budget
+  int index;
+  if (size > m_page_size) {
+    SDL_Log("A %dx%d glyph doesn't fit on a %dx%d atlas page, so it gets a page of "
+            "its own",
+            surface->w, surface->h, m_page_size, m_page_size);
+    index = add_shelf(add_page(size), height);
+  } else {
+    index = find_shelf(width, height);
+  }
+
+  Shelf& shelf = m_shelves[index];
+  Page& page = m_pages[shelf.page];
+  SDL_Rect target = {shelf.x, shelf.y, surface->w, surface->h};
+  shelf.x += width;
+  shelf.last_used = m_frame;
+
+  // Copy the glyph into the page as it is, instead of blending it in, and
+  // leave uploading it to the next flush
+  SDL_SetSurfaceBlendMode(surface, SDL_BLENDMODE_NONE);
+  SDL_BlitSurface(surface, nullptr, page.surface, &target);
+  mark_dirty(page, target);
+
+  return {.rect = {(float)target.x, (float)target.y, (float)target.w, (float)target.h},
+          .page = shelf.page,
+          .shelf = index,
+          .generation = shelf.generation};
+}
+
+// A shelf with room for a glyph of this size, making room if there's none
+int GlyphAtlas::find_shelf(int width, int height) {
+  int rounded = (height + shelf_granularity - 1) / shelf_granularity * shelf_granularity;
+
+  // The lowest shelf it fits on, but not one much taller than it, which would
+  // waste the rest of the shelf's height
+  int best = -1;
+  for (int i = 0; i < (int)m_shelves.size(); i++) {
+    const Shelf& shelf = m_shelves[i];
+    bool fits = shelf.page >= 0 && shelf.height >= height &&
+                shelf.height <= rounded + rounded / 4 &&
+                shelf.x + width <= m_pages[shelf.page].size;
+    if (fits && (best < 0 || shelf.height < m_shelves[best].height))
+      best = i;
+  }
+  if (best >= 0)
+    return best;
+
+  // A new shelf under the others on a page, or on a new page within the budget
+  for (int page = 0; page < (int)m_pages.size(); page++) {
+    if (m_pages[page].shelves_end + rounded <= m_pages[page].size)
+      return add_shelf(page, rounded);
+  }
+  if (m_memory_used == 0 || m_memory_used + page_bytes(m_page_size) <= m_memory_budget)
+    return add_shelf(add_page(m_page_size), rounded);
+
+  // Empty the least recently used shelf that's tall enough, but no taller than
+  // the first search allows. Failing that, the shortest one that's tall enough.
+  // Shelves used this frame hold glyphs that are queued to be drawn, so they're
+  // left alone
+  auto evictable = [&](const Shelf& shelf) {
+    return shelf.page >= 0 && shelf.height >= height && shelf.last_used != m_frame;
+  };
+  int oldest = -1;
+  for (int i = 0; i < (int)m_shelves.size(); i++) {
+    const Shelf& shelf = m_shelves[i];
+    if (!evictable(shelf) || shelf.height > rounded + rounded / 4)
+      continue;
+    if (oldest < 0 || shelf.last_used < m_shelves[oldest].last_used)
+      oldest = i;
+  }
+  if (oldest < 0) {
+    for (int i = 0; i < (int)m_shelves.size(); i++) {
+      const Shelf& shelf = m_shelves[i];
+      if (evictable(shelf) && (oldest < 0 || shelf.height < m_shelves[oldest].height))
+        oldest = i;
+    }
+  }
+  if (oldest >= 0) {
+    evict(oldest);
+    return oldest;
+  }
+
+  // No shelf is tall enough, e.g. the text got bigger. Empty the least recently
+  // used page that nothing drawn this frame is on, and cut it into shelves anew
+  int coldest = -1;
+  unsigned long long coldest_used = 0;
+  for (int page = 0; page < (int)m_pages.size(); page++) {
+    if (!m_pages[page].texture || m_pages[page].size < std::max(width, rounded))
+      continue;
+    unsigned long long last_used = page_last_used(page);
+    if (last_used != m_frame && (coldest < 0 || last_used < coldest_used)) {
+      coldest = page;
+      coldest_used = last_used;
+    }
+  }
+  if (coldest >= 0) {
+    reclaim_page(coldest);
+    return add_shelf(coldest, rounded);
+  }
+
+  // This frame's text needs more than the budget, so go over it rather than
+  // leave glyphs out. The page is freed by end_frame() once it goes cold
+  if (!m_over_budget)
+    SDL_Log("Glyph atlas is over its budget of %.1f MiB", m_memory_budget / 1048576.0);
+  m_over_budget = true;
+  return add_shelf(add_page(m_page_size), rounded);
+}
+
+int GlyphAtlas::add_shelf(int page, int height) {
+  Shelf shelf = {.page = page,
+                 .y = m_pages[page].shelves_end,
+                 .height = height,
+                 .x = 0,
+                 .last_used = m_frame,
+                 .generation = 0};
+  m_pages[page].shelves_end += height;
+
+  // A free slot keeps its generation, so glyphs from before it was freed stay gone
+  if (!m_free_shelves.empty()) {
+    int index = m_free_shelves.back();
+    m_free_shelves.pop_back();
+    shelf.generation = m_shelves[index].generation;
+    m_shelves[index] = shelf;
+    return index;
+  }
+  m_shelves.push_back(shelf);
+  return m_shelves.size() - 1;
+}
+
+// Returns the index of the page, which reuses the slot of a freed one if there is one
+int GlyphAtlas::add_page(int size) {
+  Page page;
+  page.size = size;
+  page.surface = SDL_CreateSurface(size, size, SDL_PIXELFORMAT_RGBA32);
+  if (page.surface == nullptr)
+    throw Error(SDL_GetError());
+
+  page.texture = SDL_CreateTexture(m_renderer, SDL_PIXELFORMAT_RGBA32,
+                                   SDL_TEXTUREACCESS_STREAMING, size, size);
+  if (page.texture == nullptr) {
+    SDL_DestroySurface(page.surface);
+    throw Error(SDL_GetError());
+  }
+  SDL_SetTextureBlendMode(page.texture, SDL_BLENDMODE_BLEND);
+
+  // New surfaces are transparent, but the texture starts out undefined
+  page.dirty = {0, 0, size, size};
+  page.shelves_end = 0;
+  m_memory_used += page_bytes(size);
+
+  for (int index = 0; index < (int)m_pages.size(); index++) {
+    if (!m_pages[index].texture) {
+      m_pages[index] = page;
+      return index;
+    }
+  }
+  m_pages.push_back(page);
+  m_batches.emplace_back();
+  return m_pages.size() - 1;
+}
+
+// The last frame any shelf on the page was used in, or 0 if it has none
+unsigned long long GlyphAtlas::page_last_used(int page) {
+  unsigned long long last_used = 0;
+  for (const Shelf& shelf : m_shelves) {
+    if (shelf.page == page)
+      last_used = std::max(last_used, shelf.last_used);
+  }
+  return last_used;
+}
+
+// Evict every glyph on the page and free its shelves, leaving the page empty
+void GlyphAtlas::reclaim_page(int index) {
+  for (int i = 0; i < (int)m_shelves.size(); i++) {
+    Shelf& shelf = m_shelves[i];
+    if (shelf.page != index)
+      continue;
+    shelf.generation++;
+    shelf.page = -1;
+    m_free_shelves.push_back(i);
+    m_evictions++;
+  }
+
+  Page& page = m_pages[index];
+  page.shelves_end = 0;
+  SDL_FillSurfaceRect(page.surface, nullptr, 0);
+  mark_dirty(page, {0, 0, page.size, page.size});
+}
+
+// Give the page's memory back. The slot is reused by the next add_page()
+void GlyphAtlas::free_page(int index) {
+  reclaim_page(index);
+
+  Page& page = m_pages[index];
+  SDL_DestroyTexture(page.texture);
+  SDL_DestroySurface(page.surface);
+  m_memory_used -= page_bytes(page.size);
+  page = {.texture = nullptr,
+          .surface = nullptr,
+          .size = 0,
+          .dirty = {0, 0, 0, 0},
+          .shelves_end = 0};
+}
+
+// Glyphs on the shelf are found to be gone the next time they're used, by the
+// generation no longer matching
+void GlyphAtlas::evict(int index) {
+  Shelf& shelf = m_shelves[index];
+  shelf.generation++;
+  shelf.x = 0;
+  m_evictions++;
+
+  Page& page = m_pages[shelf.page];
+  SDL_Rect rect = {0, shelf.y, page.size, shelf.height};
+  SDL_FillSurfaceRect(page.surface, &rect, 0);
+  mark_dirty(page, rect);
+}
+
+void GlyphAtlas::mark_dirty(Page& page, SDL_Rect rect) {
+  if (page.dirty.w == 0) {
+    page.dirty = rect;
+    return;
+  }
+
+  int right = std::max(page.dirty.x + page.dirty.w, rect.x + rect.w);
+  int bottom = std::max(page.dirty.y + page.dirty.h, rect.y + rect.h);
+  page.dirty.x = std::min(page.dirty.x, rect.x);
+  page.dirty.y = std::min(page.dirty.y, rect.y);
+  page.dirty.w = right - page.dirty.x;
+  page.dirty.h = bottom - page.dirty.y;
+}
+
+void GlyphAtlas::draw(const Glyph& glyph, float x, float y) {
+  if (glyph.rect.w == 0)
+    return;
+
+  // Two triangles per glyph, with texture coordinates from 0 to 1
+  float scale = 1.0f / m_pages[glyph.page].size;
+  float u0 = glyph.rect.x * scale, u1 = (glyph.rect.x + glyph.rect.w) * scale;
+  float v0 = glyph.rect.y * scale, v1 = (glyph.rect.y + glyph.rect.h) * scale;
+  float x1 = x + glyph.rect.w, y1 = y + glyph.rect.h;
+  SDL_FColor white = {1, 1, 1, 1};
+
+  GlyphBatch& batch = m_batches[glyph.page];
+  int first = batch.vertices.size();
+  m_queued = true;
+  batch.vertices.push_back({{x, y}, white, {u0, v0}});
+  batch.vertices.push_back({{x1, y}, white, {u1, v0}});
+  batch.vertices.push_back({{x1, y1}, white, {u1, v1}});
+  batch.vertices.push_back({{x, y1}, white, {u0, v1}});
+  for (int index : {0, 1, 2, 0, 2, 3})
+    batch.indices.push_back(first + index);
+}
+
+// Send each page's dirty region to its texture, with one call per page
+void GlyphAtlas::upload() {
+  for (Page& page : m_pages) {
+    if (page.dirty.w == 0)
+      continue;
+
+    const Uint8* pixels = (const Uint8*)page.surface->pixels +
+                          page.dirty.y * page.surface->pitch + page.dirty.x * 4;
+    SDL_UpdateTexture(page.texture, &page.dirty, pixels, page.surface->pitch);
+    page.dirty = {0, 0, 0, 0};
+  }
+}
+
+void GlyphAtlas::flush() {
+  if (!m_queued)
+    return;
+
+  upload();
+  for (size_t i = 0; i < m_batches.size(); i++) {
+    GlyphBatch& batch = m_batches[i];
+    if (batch.indices.empty())
+      continue;
+
+    SDL_RenderGeometry(m_renderer, m_pages[i].texture, batch.vertices.data(),
+                       batch.vertices.size(), batch.indices.data(), batch.indices.size());
+    m_draw_calls++;
+
+    // Keep the capacity, so a steady frame doesn't allocate
+    batch.vertices.clear();
+    batch.indices.clear();
+  }
+  m_queued = false;
+}
+
+// Glyphs are only protected from eviction during the frame they're drawn in,
+// so this is what makes them fair game afterwards. Pages that went over the
+// budget are freed here, coldest first, once nothing has used them for a while
+void GlyphAtlas::end_frame() {
+  m_frame++;
+
+  while (m_memory_used > m_memory_budget) {
+    int coldest = -1;
+    unsigned long long coldest_used = 0;
+    for (int page = 0; page < (int)m_pages.size(); page++) {
+      if (!m_pages[page].texture)
+        continue;
+      unsigned long long last_used = page_last_used(page);
+      bool cold = m_frame - last_used > cold_frames;
+      if (cold && (coldest < 0 || last_used < coldest_used)) {
+        coldest = page;
+        coldest_used = last_used;
+      }
+    }
+    if (coldest < 0)
+      break;
+    free_page(coldest);
+  }
+  if (m_memory_used <= m_memory_budget)
+    m_over_budget = false;
+}
@@ -3,11 +3,51 @@
 #include "audio.h"
 #include "error.h"
 
-AudioStream::AudioStream(const char* path, bool is_capture) {
-  m_is_capture = is_capture;
+RecordingWriter::RecordingWriter(const char* path, ma_format format, u32 channels,
+                                 u32 sample_rate, u64 buffer_frames)
+    : m_channels(channels), m_buffer(buffer_frames * channels) {
+  ma_encoder_config codec_cfg =
+      ma_encoder_config_init(ma_encoding_format_wav, format, channels, sample_rate);
+  if (ma_encoder_init_file(path, &codec_cfg, &m_encoder) != MA_SUCCESS)
+    throw Error("Failed to initialize the encoder");
+
+  // Write in batches of a quarter of a second
+  m_batch.resize((sample_rate / 4) * channels);
+  m_thread = std::jthread([this](std::stop_token token) { write_loop(token); });
+}
+
+RecordingWriter::~RecordingWriter() {
+  m_thread.request_stop();
+  m_thread.join();
+  ma_encoder_uninit(&m_encoder);
+}
+
+// Safe to call from the realtime callback: never blocks or allocates
+void RecordingWriter::push_frames(float* frames, u64 num_frames) {
+  m_buffer.push_samples(frames, num_frames * m_channels);
+}
+
+u64 RecordingWriter::dropped_frames() {
+  return m_buffer.overflowed_samples() / m_channels;
+}
+
+void RecordingWriter::write_loop(std::stop_token token) {
+  while (m_buffer.pop_samples(m_batch, token))
+    ma_encoder_write_pcm_frames(&m_encoder, m_batch.data(), m_batch.size() / m_channels,
+                                nullptr);
+
+  // Flush whatever is left once recording stops
+  u64 count = 0;
+  while ((count = m_buffer.try_pop_samples(m_batch)) > 0)
+    ma_encoder_write_pcm_frames(&m_encoder, m_batch.data(), count / m_channels, nullptr);
+}
+
+AudioStream::AudioStream(const char* path, StreamMode mode, u64 record_buffer_frames) {
+  m_mode = mode;
+  m_is_capture = mode == StreamMode::Capture;
   m_started = false;
   m_resampling = false;
-  init_device_codec(path);
+  init_device_codec(path, record_buffer_frames);
 }
 
 AudioStream::~AudioStream() {
@@ -16,9 +56,8 @@ AudioStream::~AudioStream() {
     ma_device_uninit(&m_device);
   }
 
-  if (m_is_capture)
-    ma_encoder_uninit(&m_encoder);
-  else
+  // The recorder flushes and closes its file when it's destroyed
+  if (!m_is_capture)
     ma_decoder_uninit(&m_decoder);
 
   if (m_resampling)
@@ -26,6 +65,9 @@ AudioStream::~AudioStream() {
 }
 
 void AudioStream::start(AudioCallback user_callback, void* user_data) {
+  if (m_mode == StreamMode::Offline)
+    throw Error("An offline stream has no device to start");
+
   m_user_data = user_data;
   m_user_callback = user_callback;
 
@@ -48,16 +90,20 @@ void AudioStream::start(AudioCallback user_callback, void* user_data) {
     throw Error("Failed to start the device");
 }
 
-ma_device_config AudioStream::init_device_codec(const char* path) {
+ma_device_config AudioStream::init_device_codec(const char* path,
+                                                u64 record_buffer_frames) {
   u32 channels = 1;
   ma_format fmt = ma_format_f32;
-  u32 rate = m_is_capture ? 48000 : 44100; // RNNoise requires a 48 kHz sampling rate
+  // RNNoise requires a 48 kHz sampling rate
+  u32 rate = m_mode == StreamMode::Playback ? 44100 : 48000;
+
+  m_format = fmt;
+  m_channels = channels;
+  m_sample_rate = rate;
 
   if (m_is_capture) {
-    ma_encoder_config codec_cfg =
-        ma_encoder_config_init(ma_encoding_format_wav, fmt, channels, rate);
-    if (ma_encoder_init_file(path, &codec_cfg, &m_encoder) != MA_SUCCESS)
-      throw Error("Failed to initialize the encoder");
+    m_recorder = std::make_unique<RecordingWriter>(path, fmt, channels, rate,
+                                                   record_buffer_frames);
   } else {
     ma_decoder_config codec_cfg = ma_decoder_config_init(fmt, channels, rate);
     if (ma_decoder_init_file(path, &codec_cfg, &m_decoder) != MA_SUCCESS)
@@ -74,18 +120,36 @@ ma_device_config AudioStream::init_device_codec(const char* path) {
   return m_dev_cfg;
 }
 
-u32 AudioStream::sample_rate() {
-  return m_is_capture ? m_encoder.config.sampleRate : m_decoder.outputSampleRate;
+u32 AudioStream::sample_rate() { return m_sample_rate; }
+
+// Length of the file being streamed, or 0 when capturing or if the decoder
+// can't tell
+u64 AudioStream::length_in_frames() {
+  ma_uint64 length = 0;
+  if (m_is_capture)
+    return 0;
+  if (ma_decoder_get_length_in_pcm_frames(&m_decoder, &length) != MA_SUCCESS)
+    return 0;
+  return length;
+}
+
+u64 AudioStream::dropped_recording_frames() {
+  return m_recorder ? m_recorder->dropped_frames() : 0;
 }
 
 std::vector<float> AudioStream::get_samples(std::stop_token token, int size) {
   return m_samples.is_empty() ? std::vector<float>{} : m_samples.pop_samples(size, token);
 }
 
+// Block until `output` is full. Returns false if a stop was requested
+bool AudioStream::get_samples(std::stop_token token, std::span<float> output) {
+  return m_samples.pop_samples(output, token);
+}
+
 void AudioStream::queue_samples(const void* input, void* output, u64 num_samples) {
   u64 amount = num_samples;
-  if (m_is_capture) // Write the captured audio to the output file
-    ma_encoder_write_pcm_frames(&m_encoder, input, num_samples, nullptr);
+  if (m_is_capture) // Hand the captured audio over to the recording writer
+    m_recorder->push_frames((float*)input, num_samples);
   else // Read the frames into the output buffer
     ma_decoder_read_pcm_frames(&m_decoder, output, num_samples, &amount);
 
@@ -93,13 +157,21 @@ void AudioStream::queue_samples(const void* input, void* output, u64 num_samples
   m_samples.push_samples(ptr, amount);
 }
 
-void AudioStream::enable_resampler(u32 samplerate) {
-  ma_format in_fmt = m_is_capture ? m_encoder.config.format : m_decoder.outputFormat;
-  u32 in_channels = m_is_capture ? m_encoder.config.channels : m_decoder.outputChannels;
-  u32 in_rate = m_is_capture ? m_encoder.config.sampleRate : m_decoder.outputSampleRate;
+// Pull frames straight from the decoder, bypassing the device. Only valid for
+// offline streams. Returns the number of frames read, which is 0 at the end
+u64 AudioStream::read_frames(std::span<float> output) {
+  if (m_mode != StreamMode::Offline)
+    return 0;
 
+  u64 read = 0;
+  u64 capacity = output.size() / m_channels;
+  ma_decoder_read_pcm_frames(&m_decoder, output.data(), capacity, &read);
+  return read;
+}
+
+void AudioStream::enable_resampler(u32 samplerate) {
   ma_data_converter_config config = ma_data_converter_config_init(
-      in_fmt, in_fmt, in_channels, in_channels, in_rate, samplerate);
+      m_format, m_format, m_channels, m_channels, m_sample_rate, samplerate);
 
   if (ma_data_converter_init(&config, nullptr, &m_converter) != MA_SUCCESS)
     throw Error("Failed to create the resampler");
@@ -122,3 +194,25 @@ std::vector<float> AudioStream::resample(float* samples, u64 length) {
   output.resize(read);
   return output;
 }
+
+// Resample into a caller provided buffer, returning the number of frames written
+u64 AudioStream::resample(std::span<float> samples, std::span<float> output) {
+  if (!m_resampling)
+    return 0;
+
+  u64 length = samples.size();
+  u64 written = output.size();
+  ma_result result = ma_data_converter_process_pcm_frames(
+      &m_converter, (const void*)samples.data(), &length, (void*)output.data(), &written);
+  if (result != MA_SUCCESS)
+    throw Error("Failed to convert samples");
+  return written;
+}
+
+// Upper bound on the number of frames resampling `length` frames can produce
+u64 AudioStream::resampled_size(u64 length) {
+  u64 count = 0;
+  if (m_resampling)
+    ma_data_converter_get_expected_output_frame_count(&m_converter, length, &count);
+  return count + 1; // The resampler can carry a frame over between calls
+}
@@ -0,0 +1,177 @@
+#include <algorithm>
+
+#include "batch.h"
+#include "error.h"
+
+u64 find_quiet_cut(std::span<const float> samples, u64 min, u64 max, u32 sample_rate) {
+  u64 window = sample_rate / 100; // 10 ms
+  max = std::min<u64>(max, samples.size());
+  if (min + window >= max)
+    return max;
+
+  // Running sum of the energy of every window in the search range
+  std::vector<double> energy = {0.0};
+  for (u64 start = min; start + window <= max; start += window) {
+    double sum = 0;
+    for (u64 i = start; i < start + window; i++)
+      sum += samples[i] * samples[i];
+    energy.push_back(energy.back() + sum);
+  }
+
+  // Average over the neighbouring 200 ms, so that a single quiet window in the
+  // middle of a word doesn't win over a real pause
+  const int radius = 10;
+  int count = energy.size() - 1;
+  int best = 0;
+  double best_energy = -1;
+  for (int i = 0; i < count; i++) {
+    int lo = std::max(0, i - radius);
+    int hi = std::min(count, i + radius + 1);
+    double average = (energy[hi] - energy[lo]) / (hi - lo);
+    if (best_energy < 0 || average < best_energy) {
+      best_energy = average;
+      best = i;
+    }
+  }
+
+  return min + best * window + window / 2;
+}
+
+BatchTranscriber::BatchTranscriber(SpeechToText& stt, u32 sample_rate, int num_workers,
+                                   double segment_seconds)
+    : m_stt(stt), m_sample_rate(sample_rate) {
+  num_workers = std::max(num_workers, 1);
+  m_segment_length = segment_seconds * sample_rate;
+  m_max_pending = num_workers * 2;
+  m_num_segments = 0;
+  m_finished = false;
+
+  // Workers make a resampler per segment, so check the settings work up front
+  m_converter_config = ma_data_converter_config_init(ma_format_f32, ma_format_f32, 1, 1,
+                                                     sample_rate, 16000);
+  ma_data_converter converter;
+  if (ma_data_converter_init(&m_converter_config, nullptr, &converter) != MA_SUCCESS)
+    throw Error("Failed to create the resampler");
+  ma_data_converter_uninit(&converter, nullptr);
+
+  for (int i = 0; i < num_workers; i++)
+    m_workers.emplace_back([this](std::stop_token token) { worker_loop(token); });
+}
+
+void BatchTranscriber::push_samples(std::span<const float> samples) {
+  m_pending.insert(m_pending.end(), samples.begin(), samples.end());
+
+  // Cut within a quarter of a segment of the target length
+  u64 slack = m_segment_length / 4;
+  while (m_pending.size() >= m_segment_length + slack) {
+    u64 min = m_segment_length - slack;
+    u64 max = m_segment_length + slack;
+    dispatch(find_quiet_cut(m_pending, min, max, m_sample_rate));
+  }
+}
+
+std::vector<std::string> BatchTranscriber::finish() {
+  if (m_pending.size() > 0)
+    dispatch(m_pending.size());
+
+  {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_finished = true;
+  }
+  m_have_jobs.notify_all();
+  for (std::jthread& worker : m_workers)
+    worker.join();
+
+  std::vector<std::string> lines;
+  for (std::vector<std::string>& segment : m_results)
+    lines.insert(lines.end(), segment.begin(), segment.end());
+  return lines;
+}
+
+// Hand the first `length` pending samples over to the workers
+void BatchTranscriber::dispatch(u64 length) {
+  Job job = {m_num_segments++,
+             std::vector<float>(m_pending.begin(), m_pending.begin() + length)};
+  m_pending.erase(m_pending.begin(), m_pending.begin() + length);
+
+  std::unique_lock<std::mutex> guard(m_mutex);
+  m_have_space.wait(guard, [&] { return m_jobs.size() < m_max_pending; });
+  m_jobs.push_back(std::move(job));
+  m_results.emplace_back();
+  m_have_jobs.notify_one();
+}
+
+// Segments handed to a worker aren't contiguous, so the denoiser and the
+// resampler start fresh for each one. Otherwise their history from one segment
+// would bleed into the start of the next
+void BatchTranscriber::worker_loop(std::stop_token token) {
+  int frame_size = renamenoise_get_frame_size();
+  std::vector<float> frame(frame_size);
+  std::vector<float> denoised(frame_size);
+  std::vector<float> resampled;
+
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> guard(m_mutex);
+      auto lambda = [&] { return !m_jobs.empty() || m_finished; };
+      if (!m_have_jobs.wait(guard, token, lambda) || m_jobs.empty())
+        break; // Stopped, or there's no work left
+
+      job = std::move(m_jobs.front());
+      m_jobs.pop_front();
+    }
+    m_have_space.notify_one();
+
+    ReNameNoiseDenoiseState* denoiser = renamenoise_create(nullptr);
+    ma_data_converter converter;
+    ma_data_converter_init(&m_converter_config, nullptr, &converter);
+
+    // Denoise and resample the segment to 16 kHz, one frame at a time
+    resampled.clear();
+    for (size_t i = 0; i < job.samples.size(); i += frame_size) {
+      u64 length = std::min<u64>(frame_size, job.samples.size() - i);
+      std::fill(frame.begin(), frame.end(), 0.0f);
+      std::copy(job.samples.begin() + i, job.samples.begin() + i + length, frame.begin());
+      renamenoise_process_frame(denoiser, denoised.data(), frame.data());
+      resample(converter, std::span<const float>(denoised.data(), length), resampled);
+    }
+
+    // The resampler holds back a few frames to interpolate with. Push silence
+    // through to get them out, keeping only as much as the segment is long
+    u64 expected = job.samples.size() * 16000 / m_sample_rate;
+    std::fill(frame.begin(), frame.end(), 0.0f);
+    u64 padding = ma_data_converter_get_input_latency(&converter);
+    while (padding > 0 && resampled.size() < expected) {
+      u64 length = std::min<u64>(padding, frame_size);
+      resample(converter, std::span<const float>(frame.data(), length), resampled);
+      padding -= length;
+    }
+    resampled.resize(std::min<u64>(resampled.size(), expected));
+
+    ma_data_converter_uninit(&converter, nullptr);
+    renamenoise_destroy(denoiser);
+
+    std::vector<std::string> lines;
+    m_stt.transcribe_segment(resampled, lines);
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_results[job.index] = std::move(lines);
+  }
+}
+
+// Resample `input` to 16 kHz, appending to `output`
+void BatchTranscriber::resample(ma_data_converter& converter,
+                                std::span<const float> input,
+                                std::vector<float>& output) {
+  u64 length = input.size();
+  u64 written = 0;
+  ma_data_converter_get_expected_output_frame_count(&converter, length, &written);
+  written += 1;
+
+  size_t offset = output.size();
+  output.resize(offset + written);
+  ma_data_converter_process_pcm_frames(&converter, input.data(), &length,
+                                       output.data() + offset, &written);
+  output.resize(offset + written);
+}
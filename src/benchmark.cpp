@@ -0,0 +1,461 @@
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utf8.h>
+#include <vector>
+
+#include "analysis.h"
+#include "benchmark.h"
+#include "error.h"
+#include "font.h"
+#include "rope.h"
+#include "sessions.h"
+#include "transcriber.h"
+
+using Clock = std::chrono::steady_clock;
+
+static double microseconds_since(Clock::time_point start, int count) {
+  std::chrono::duration<double, std::micro> elapsed = Clock::now() - start;
+  return elapsed.count() / count;
+}
+
+static size_t codepoint_start(const std::string& text, size_t offset) {
+  while (offset > 0 && offset < text.size() &&
+         ((unsigned char)text[offset] & 0xC0) == 0x80)
+    offset--;
+  return offset;
+}
+
+// Random small edits, line lookups and snapshots on a 10 MB document, with a
+// rope and with a plain std::string
+static void benchmark_rope() {
+  const char* words[] = {"the", "quick", "brown", "fox", "jumps", "over", "lazy",
+                         "dog", "naïve", "café", "日本語", "note", "speech"};
+  std::mt19937 rng(42);
+
+  std::string text;
+  text.reserve(10 << 20);
+  while (text.size() < 10 << 20) {
+    text += words[rng() % std::size(words)];
+    text += rng() % 12 == 0 ? '\n' : ' ';
+  }
+  Rope rope(text);
+  SDL_Log("Document: %.1f MiB, %zu lines", text.size() / 1048576.0, rope.line_count());
+
+  // The same edits are applied to both, so the results can be compared
+  struct Edit {
+    bool insert;
+    size_t position; // Scaled to the document size when applied
+    size_t length;
+  };
+  const int edit_count = 10000;
+  std::vector<Edit> edits(edit_count);
+  for (Edit& edit : edits)
+    edit = {rng() % 2 == 0, rng(), rng() % 16 + 1};
+
+  const std::string inserted = "inserted text";
+  auto start = Clock::now();
+  for (const Edit& edit : edits) {
+    size_t offset = codepoint_start(text, edit.position % (text.size() + 1));
+    if (edit.insert) {
+      text.insert(offset, inserted, 0, std::min(edit.length, inserted.size()));
+    } else {
+      size_t end = codepoint_start(text, std::min(text.size(), offset + edit.length));
+      text.erase(offset, end - offset);
+    }
+  }
+  double string_edit = microseconds_since(start, edit_count);
+
+  start = Clock::now();
+  for (const Edit& edit : edits) {
+    size_t offset = edit.position % (rope.size() + 1);
+    if (edit.insert) {
+      rope.insert(offset, std::string_view(inserted).substr(0, edit.length));
+    } else {
+      rope.erase(offset, edit.length);
+    }
+  }
+  double rope_edit = microseconds_since(start, edit_count);
+  SDL_Log("Random edits: std::string %.2fus, rope %.2fus", string_edit, rope_edit);
+
+  if (rope.to_string() != text)
+    SDL_Log("Rope and std::string contents differ!");
+
+  // Line number -> byte offset. The string has to scan from the start
+  const int string_lookups = 100, rope_lookups = 10000;
+  size_t lines = rope.line_count(), sum = 0;
+  start = Clock::now();
+  for (int i = 0; i < string_lookups; i++) {
+    size_t line = rng() % lines, offset = 0;
+    for (size_t n = 0; n < line; n++)
+      offset = text.find('\n', offset) + 1;
+    sum += offset;
+  }
+  double string_lookup = microseconds_since(start, string_lookups);
+
+  start = Clock::now();
+  for (int i = 0; i < rope_lookups; i++) {
+    LineColumn position = rope.position(rope.line_start(rng() % lines) + 3);
+    sum += position.column;
+  }
+  double rope_lookup = microseconds_since(start, rope_lookups);
+  SDL_Log("Line lookups: std::string %.2fus, rope %.2fus (%zu)", string_lookup,
+          rope_lookup, sum % 10);
+
+  // Snapshots, e.g. to hand the document to another thread
+  const int snapshots = 100;
+  start = Clock::now();
+  for (int i = 0; i < snapshots; i++) {
+    std::string copy = text;
+    sum += copy.size();
+  }
+  double string_snapshot = microseconds_since(start, snapshots);
+
+  start = Clock::now();
+  for (int i = 0; i < snapshots; i++) {
+    Rope copy = rope;
+    sum += copy.size();
+  }
+  double rope_snapshot = microseconds_since(start, snapshots);
+  SDL_Log("Snapshots: std::string %.2fus, rope %.2fus", string_snapshot, rope_snapshot);
+}
+
+// Cost of analyzing one audio callback at 48 kHz, with every kernel the CPU
+// supports, as time per callback and as a share of the time between callbacks
+static void benchmark_analysis() {
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+  std::vector<float> samples(1 << 20);
+  for (float& sample : samples)
+    sample = distribution(rng);
+
+  const size_t buffer_sizes[] = {64, 128, 256, 480, 512, 1024, 2048, 4096};
+  const double sample_rate = 48000;
+  SDL_Log("Using the %s kernel", analysis_kernel_name());
+
+  float sink = 0;
+  for (size_t buffer_size : buffer_sizes) {
+    // Walk through a buffer larger than the caches hold, like fresh audio would be
+    const int callbacks = 200000;
+    size_t buffers = samples.size() / buffer_size;
+    for (const AnalysisKernel& kernel : analysis_kernels()) {
+      auto start = Clock::now();
+      for (int i = 0; i < callbacks; i++) {
+        const float* buffer = &samples[(i % buffers) * buffer_size];
+        sink += kernel.analyze(buffer, buffer_size).rms;
+      }
+      double per_callback = microseconds_since(start, callbacks);
+      double period = buffer_size / sample_rate * 1e6;
+      SDL_Log("%4zu samples, %-6s %.3fus per callback (%.4f%% of the period)",
+              buffer_size, kernel.name, per_callback, per_callback / period * 100);
+    }
+  }
+  SDL_Log("(%.1f)", sink);
+}
+
+// Hidden window for the benchmarks that draw, with vsync off so frames aren't
+// throttled
+class BenchmarkWindow {
+public:
+  BenchmarkWindow() {
+    if (!SDL_Init(SDL_INIT_VIDEO))
+      throw Error(SDL_GetError());
+    m_window = SDL_CreateWindow("didact", 1280, 720, SDL_WINDOW_HIDDEN);
+    if (!m_window)
+      throw Error(SDL_GetError());
+    m_renderer = SDL_CreateRenderer(m_window, nullptr);
+    if (!m_renderer)
+      throw Error(SDL_GetError());
+    SDL_SetRenderVSync(m_renderer, 0);
+  }
+
+  ~BenchmarkWindow() {
+    SDL_DestroyRenderer(m_renderer);
+    SDL_DestroyWindow(m_window);
+    SDL_Quit();
+  }
+
+  SDL_Renderer* renderer() { return m_renderer; }
+
+private:
+  SDL_Window* m_window;
+  SDL_Renderer* m_renderer;
+};
+
+// Draw 10,000 glyphs a frame, flushing after every glyph (one draw call each,
+// the way text used to be drawn) and then once a frame, batched by atlas texture
+static void benchmark_text() {
+  BenchmarkWindow window;
+  SDL_Renderer* renderer = window.renderer();
+  GlyphAtlas atlas(renderer);
+  FontCache font(atlas, "../assets/Roboto-Regular.ttf", 18, {255, 255, 255, 255});
+
+  // 100 rows of 100 printable ASCII characters, on a fixed grid
+  std::mt19937 rng(42);
+  std::string text(10000, ' ');
+  for (char& c : text)
+    c = 33 + rng() % 94;
+
+  auto draw_frame = [&](bool batched) {
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderClear(renderer);
+    for (size_t i = 0; i < text.size(); i++) {
+      Vec2 position = {(i % 100) * 12.0f, (i / 100) * 7.0f};
+      font.render(std::string_view(text).substr(i, 1), position);
+      if (!batched)
+        atlas.flush();
+    }
+    atlas.flush();
+    atlas.end_frame();
+    SDL_RenderPresent(renderer);
+  };
+
+  const int frames = 100;
+  for (bool batched : {false, true}) {
+    draw_frame(batched); // Warm up
+    unsigned long long draw_calls = atlas.draw_calls();
+    auto start = Clock::now();
+    for (int i = 0; i < frames; i++)
+      draw_frame(batched);
+    double frame_time = microseconds_since(start, frames) / 1000;
+    unsigned long long calls_per_frame = (atlas.draw_calls() - draw_calls) / frames;
+    SDL_Log("%s: %llu draw calls per frame, %.2fms per frame",
+            batched ? "Batched" : "Per glyph", calls_per_frame, frame_time);
+  }
+}
+
+// About 10,000 characters of ASCII, and of Latin, Greek, Cyrillic, CJK and emoji
+static std::string benchmark_sample_text(bool mixed) {
+  const char* ascii[] = {"the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog"};
+  const char* scripts[] = {"naïve", "café", "γειά", "σου", "привет", "мир",
+                           "日本語", "你好", "😀", "🎤", "note", "speech"};
+  std::mt19937 rng(42);
+  std::string text;
+  while (utf8::distance(text.begin(), text.end()) < 10000) {
+    text += mixed ? scripts[rng() % std::size(scripts)] : ascii[rng() % std::size(ascii)];
+    text += ' ';
+  }
+  return text;
+}
+
+// Looking up every character of a text in the glyph table, against the
+// unordered_map (contains, then operator[]) it replaced. Then render() and
+// text_size() of the whole font cache, which need a window
+static void benchmark_glyphs() {
+  const int repeats = 1000;
+  for (bool mixed : {false, true}) {
+    std::string text = benchmark_sample_text(mixed);
+    std::vector<unsigned int> codepoints;
+    utf8::utf8to32(text.begin(), text.end(), std::back_inserter(codepoints));
+
+    GlyphTable table;
+    std::unordered_map<unsigned int, Glyph> map;
+    for (unsigned int codepoint : codepoints) {
+      Glyph glyph = {{0, 0, (float)(codepoint % 13), 18}, 0, -1, 0};
+      table.insert(codepoint, glyph);
+      map[codepoint] = glyph;
+    }
+
+    float sum = 0;
+    auto start = Clock::now();
+    for (int i = 0; i < repeats; i++) {
+      for (unsigned int codepoint : codepoints) {
+        if (map.contains(codepoint))
+          sum += map[codepoint].rect.w;
+      }
+    }
+    double map_lookup = microseconds_since(start, repeats) * 1000 / codepoints.size();
+
+    start = Clock::now();
+    for (int i = 0; i < repeats; i++) {
+      for (unsigned int codepoint : codepoints) {
+        if (const Glyph* glyph = table.find(codepoint))
+          sum += glyph->rect.w;
+      }
+    }
+    double table_lookup = microseconds_since(start, repeats) * 1000 / codepoints.size();
+    SDL_Log("%s lookups: unordered_map %.2fns, glyph table %.2fns (%.0f)",
+            mixed ? "Mixed script" : "ASCII", map_lookup, table_lookup, sum);
+  }
+
+  BenchmarkWindow window;
+  GlyphAtlas atlas(window.renderer());
+  FontCache font(atlas, "../assets/Roboto-Regular.ttf", 18, {255, 255, 255, 255});
+
+  const int passes = 100;
+  for (bool mixed : {false, true}) {
+    std::string text = benchmark_sample_text(mixed);
+    size_t length = utf8::distance(text.begin(), text.end());
+    font.render(text, {0, 0}); // Rasterize every glyph before timing
+    atlas.flush();
+    atlas.end_frame();
+
+    float width = 0;
+    auto start = Clock::now();
+    for (int i = 0; i < passes; i++)
+      width += font.text_size(text).x;
+    double measure = microseconds_since(start, passes) * 1000 / length;
+
+    start = Clock::now();
+    for (int i = 0; i < passes; i++) {
+      font.render(text, {0, 0});
+      atlas.flush();
+      atlas.end_frame();
+    }
+    double render = microseconds_since(start, passes) * 1000 / length;
+    SDL_Log("%s per character: text_size %.2fns, render %.2fns (%.0f)",
+            mixed ? "Mixed script" : "ASCII", measure, render, width);
+  }
+}
+
+// Mixed-script text at eight sizes, all in one atlas, with a budget that holds
+// only part of it. Each frame draws the text at two of the sizes, so glyphs for
+// the others go cold and get evicted
+static void benchmark_atlas() {
+  BenchmarkWindow window;
+  const size_t budget = 8 << 20;
+  GlyphAtlas atlas(window.renderer(), budget);
+
+  const int sizes[] = {12, 14, 16, 18, 24, 32, 40, 48};
+  std::vector<std::unique_ptr<FontCache>> fonts;
+  for (int size : sizes) {
+    fonts.push_back(std::make_unique<FontCache>(atlas, "../assets/Roboto-Regular.ttf",
+                                                size, SDL_Color{255, 255, 255, 255}));
+  }
+
+  std::string text = benchmark_sample_text(true);
+  std::vector<std::string_view> lines; // About 400 bytes each
+  for (size_t start = 0; start < text.size();) {
+    size_t end = codepoint_start(text, std::min(text.size(), start + 400));
+    lines.push_back(std::string_view(text).substr(start, end - start));
+    start = end;
+  }
+
+  const int frames = 200;
+  auto start = Clock::now();
+  for (int frame = 0; frame < frames; frame++) {
+    for (int i : {frame % 8, (frame / 8) % 8}) {
+      std::string_view line = lines[frame % lines.size()];
+      fonts[i]->render(line, {0, (float)(i * 50)});
+    }
+    atlas.flush();
+    atlas.end_frame();
+  }
+  double frame_time = microseconds_since(start, frames) / 1000;
+  SDL_Log("%.2fms per frame, %.1f of %.1f MiB used, %llu shelves evicted", frame_time,
+          atlas.memory_used() / 1048576.0, budget / 1048576.0, atlas.evictions());
+}
+
+void run_benchmark(const char* name) {
+  std::string_view benchmark = name;
+  if (benchmark == "rope")
+    benchmark_rope();
+  else if (benchmark == "analysis")
+    benchmark_analysis();
+  else if (benchmark == "text")
+    benchmark_text();
+  else if (benchmark == "glyphs")
+    benchmark_glyphs();
+  else if (benchmark == "atlas")
+    benchmark_atlas();
+  else
+    throw Error("Unknown benchmark: {}", benchmark);
+}
+
+// Transcribe a file with 1, 2, 4... workers up to the hardware thread count, and
+// log how close each gets to a linear speedup over a single worker
+static void benchmark_batch(ModelPaths paths, RecognizerConfig config,
+                            const char* audio_path) {
+  int max_jobs = std::max((int)std::thread::hardware_concurrency(), 1);
+  std::vector<int> job_counts;
+  for (int jobs = 1; jobs < max_jobs; jobs *= 2)
+    job_counts.push_back(jobs);
+  job_counts.push_back(max_jobs);
+
+  double single_worker = 0;
+  for (int jobs : job_counts) {
+    Transcriber engine(paths, audio_path, StreamMode::Offline, config);
+    OfflineStats stats = engine.transcribe_parallel(jobs);
+    if (jobs == 1)
+      single_worker = stats.wall_seconds;
+
+    double speedup = stats.wall_seconds > 0 ? single_worker / stats.wall_seconds : 0;
+    SDL_Log("%2d workers: %.1fs (real time factor: %.4f), %.1fx speedup, %.0f%% "
+            "efficiency",
+            jobs, stats.wall_seconds, stats.real_time_factor, speedup,
+            speedup / jobs * 100);
+  }
+}
+
+// Open 1, 8 and 32 sessions on one recognizer and feed each the first 30 s of a
+// file in 100 ms chunks, at the pace of live audio. Then log how big the batches
+// got and how long sessions waited for their results
+static void benchmark_sessions(ModelPaths paths, RecognizerConfig config,
+                               const char* audio_path) {
+  AudioStream stream(audio_path, StreamMode::Offline);
+  stream.enable_resampler(16000);
+  std::vector<float> audio;
+  std::vector<float> block(stream.sample_rate());
+  while (audio.size() < 16000 * 30) {
+    u64 read = stream.read_frames(block);
+    if (read == 0)
+      break;
+    std::vector<float> resampled = stream.resample(block.data(), read);
+    audio.insert(audio.end(), resampled.begin(), resampled.end());
+  }
+
+  SpeechToText stt(paths, config);
+  auto handler = [](void*, std::string, bool) {};
+  const size_t chunk_size = 1600;
+
+  for (int count : {1, 8, 32}) {
+    SessionScheduler scheduler(stt);
+    std::vector<SessionId> ids;
+    for (int i = 0; i < count; i++)
+      ids.push_back(scheduler.open_session(handler, nullptr));
+
+    auto start = Clock::now();
+    for (size_t offset = 0; offset < audio.size(); offset += chunk_size) {
+      int length = std::min(chunk_size, audio.size() - offset);
+      for (SessionId id : ids)
+        scheduler.accept_samples(id, audio.data() + offset, length);
+      std::this_thread::sleep_until(start + std::chrono::milliseconds(
+                                                (offset + chunk_size) * 1000 / 16000));
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(1)); // Let the last batch finish
+
+    double average_latency = 0, max_latency = 0;
+    for (SessionId id : ids) {
+      SessionStats stats = scheduler.session_stats(id);
+      average_latency += stats.average_latency_ms / count;
+      max_latency = std::max(max_latency, stats.max_latency_ms);
+    }
+
+    BatchStats batches = scheduler.batch_stats();
+    SDL_Log("%2d sessions: %llu batches, %.1f streams per batch (max %zu), latency "
+            "%.1fms average, %.1fms max",
+            count, batches.batches, batches.average_batch_size, batches.max_batch_size,
+            average_latency, max_latency);
+  }
+}
+
+bool is_model_benchmark(const char* name) {
+  std::string_view benchmark = name;
+  return benchmark == "batch" || benchmark == "sessions";
+}
+
+void run_model_benchmark(const char* name, ModelPaths paths, RecognizerConfig config,
+                         const char* audio_path) {
+  std::string_view benchmark = name;
+  if (benchmark == "batch")
+    benchmark_batch(paths, config, audio_path);
+  else if (benchmark == "sessions")
+    benchmark_sessions(paths, config, audio_path);
+  else
+    throw Error("Unknown benchmark: {}", benchmark);
+}
@@ -0,0 +1,108 @@
+#include <charconv>
+#include <fstream>
+
+#include "config.h"
+#include "error.h"
+
+template <typename T>
+static T parse_number(std::string_view key, std::string_view value) {
+  T number{};
+  auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), number);
+  if (error != std::errc() || end != value.data() + value.size())
+    throw Error("Invalid value for {}: '{}'", key, value);
+  return number;
+}
+
+static bool parse_bool(std::string_view key, std::string_view value) {
+  if (value == "true" || value == "1" || value == "yes")
+    return true;
+  if (value == "false" || value == "0" || value == "no")
+    return false;
+  throw Error("Invalid value for {}: '{}'", key, value);
+}
+
+void set_option(RecognizerConfig& config, std::string_view key, std::string_view value) {
+  if (key == "threads")
+    config.threads = std::max(parse_number<int>(key, value), 1);
+  else if (key == "provider")
+    config.provider = value;
+  else if (key == "decoding-method") {
+    if (value != "greedy_search" && value != "modified_beam_search")
+      throw Error("Unknown decoding method: '{}'", value);
+    config.decoding_method = value;
+  } else if (key == "max-active-paths")
+    config.max_active_paths = std::max(parse_number<int>(key, value), 1);
+  else if (key == "int8")
+    config.int8 = parse_bool(key, value);
+  else if (key == "auto-tune")
+    config.auto_tune = parse_bool(key, value);
+  else if (key == "adaptive")
+    config.adaptive = parse_bool(key, value);
+  else if (key == "rule1-min-trailing-silence")
+    config.rule1_min_trailing_silence = parse_number<float>(key, value);
+  else if (key == "rule2-min-trailing-silence")
+    config.rule2_min_trailing_silence = parse_number<float>(key, value);
+  else if (key == "rule3-min-utterance-length")
+    config.rule3_min_utterance_length = parse_number<float>(key, value);
+  else
+    throw Error("Unknown option: '{}'", key);
+}
+
+static std::string_view trim(std::string_view str) {
+  size_t start = str.find_first_not_of(" \t\r");
+  if (start == std::string_view::npos)
+    return {};
+  size_t end = str.find_last_not_of(" \t\r");
+  return str.substr(start, end - start + 1);
+}
+
+void load_config_file(RecognizerConfig& config, const char* path) {
+  std::ifstream file(path);
+  if (!file)
+    throw Error("Failed to open the config file {}", path);
+
+  std::string line;
+  while (std::getline(file, line)) {
+    std::string_view view = trim(std::string_view(line).substr(0, line.find('#')));
+    if (view.empty())
+      continue;
+
+    size_t equals = view.find('=');
+    if (equals == std::string_view::npos)
+      throw Error("Expected `key = value` in {}, got '{}'", path, view);
+    set_option(config, trim(view.substr(0, equals)), trim(view.substr(equals + 1)));
+  }
+}
+
+bool parse_config_flag(RecognizerConfig& config, int argc, char** argv, int& index) {
+  std::string_view arg = argv[index];
+  if (!arg.starts_with("--"))
+    return false;
+  std::string_view key = arg.substr(2);
+
+  if (key == "config" && index + 1 < argc) {
+    load_config_file(config, argv[++index]);
+    return true;
+  }
+
+  // Boolean options can be given as bare flags
+  if (key == "int8" || key == "auto-tune") {
+    set_option(config, key, "true");
+    return true;
+  }
+
+  bool known = key == "threads" || key == "provider" || key == "decoding-method" ||
+               key == "max-active-paths" || key == "adaptive" || key.starts_with("rule");
+  if (!known || index + 1 >= argc)
+    return false;
+
+  set_option(config, key, argv[++index]);
+  return true;
+}
+
+std::string int8_variant(const char* path) {
+  std::string str(path);
+  if (str.ends_with(".onnx") && !str.ends_with(".int8.onnx"))
+    str.insert(str.size() - 5, ".int8");
+  return str;
+}
@@ -0,0 +1,190 @@
+#include <bit>
+#include <cmath>
+#include <numbers>
+
+#include "error.h"
+#include "fft.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+RealFft::RealFft(size_t size) : m_size(size) {
+  if (size < 8 || !std::has_single_bit(size))
+    throw Error("FFT size must be a power of two of at least 8, not {}", size);
+
+  size_t points = size / 2;
+  int bits = std::countr_zero(points);
+  m_reverse.resize(points);
+  for (size_t i = 0; i < points; i++) {
+    std::uint32_t reversed = 0;
+    for (int bit = 0; bit < bits; bit++)
+      reversed |= ((i >> bit) & 1) << (bits - 1 - bit);
+    m_reverse[i] = reversed;
+  }
+
+  m_twiddle_real.resize(points);
+  m_twiddle_imag.resize(points);
+  for (size_t m = 1; m < points; m *= 2) {
+    for (size_t j = 0; j < m; j++) {
+      double angle = -std::numbers::pi * j / m;
+      m_twiddle_real[m - 1 + j] = std::cos(angle);
+      m_twiddle_imag[m - 1 + j] = std::sin(angle);
+    }
+  }
+
+  m_split_real.resize(points);
+  m_split_imag.resize(points);
+  for (size_t k = 0; k < points; k++) {
+    double angle = -2 * std::numbers::pi * k / size;
+    m_split_real[k] = std::cos(angle);
+    m_split_imag[k] = std::sin(angle);
+  }
+
+  m_real.resize(points);
+  m_imag.resize(points);
+}
+
+// Two radix-2 passes in one, over blocks of 4m points: the first combines pairs
+// of m-point blocks, the second pairs of the resulting 2m-point blocks. Every
+// point is loaded and stored once instead of twice.
+static void radix4_pass(float* re, float* im, const float* w_re, const float* w_im,
+                        size_t points, size_t m) {
+  const float* w1_re = w_re + m - 1;
+  const float* w1_im = w_im + m - 1;
+  const float* w2_re = w_re + 2 * m - 1;
+  const float* w2_im = w_im + 2 * m - 1;
+
+  for (size_t k = 0; k < points; k += 4 * m) {
+    size_t j = 0;
+#ifdef __SSE2__
+    for (; j + 4 <= m; j += 4) {
+      float* a_re = re + k + j;
+      float* a_im = im + k + j;
+      __m128 ar = _mm_loadu_ps(a_re), ai = _mm_loadu_ps(a_im);
+      __m128 br = _mm_loadu_ps(a_re + m), bi = _mm_loadu_ps(a_im + m);
+      __m128 cr = _mm_loadu_ps(a_re + 2 * m), ci = _mm_loadu_ps(a_im + 2 * m);
+      __m128 dr = _mm_loadu_ps(a_re + 3 * m), di = _mm_loadu_ps(a_im + 3 * m);
+
+      // First pass: (a, b) and (c, d), both with W_2m^j
+      __m128 wr = _mm_loadu_ps(w1_re + j), wi = _mm_loadu_ps(w1_im + j);
+      __m128 tr = _mm_sub_ps(_mm_mul_ps(wr, br), _mm_mul_ps(wi, bi));
+      __m128 ti = _mm_add_ps(_mm_mul_ps(wr, bi), _mm_mul_ps(wi, br));
+      br = _mm_sub_ps(ar, tr), bi = _mm_sub_ps(ai, ti);
+      ar = _mm_add_ps(ar, tr), ai = _mm_add_ps(ai, ti);
+      tr = _mm_sub_ps(_mm_mul_ps(wr, dr), _mm_mul_ps(wi, di));
+      ti = _mm_add_ps(_mm_mul_ps(wr, di), _mm_mul_ps(wi, dr));
+      dr = _mm_sub_ps(cr, tr), di = _mm_sub_ps(ci, ti);
+      cr = _mm_add_ps(cr, tr), ci = _mm_add_ps(ci, ti);
+
+      // Second pass: (a, c) with W_4m^j, and (b, d) with W_4m^(j + m)
+      wr = _mm_loadu_ps(w2_re + j), wi = _mm_loadu_ps(w2_im + j);
+      tr = _mm_sub_ps(_mm_mul_ps(wr, cr), _mm_mul_ps(wi, ci));
+      ti = _mm_add_ps(_mm_mul_ps(wr, ci), _mm_mul_ps(wi, cr));
+      _mm_storeu_ps(a_re + 2 * m, _mm_sub_ps(ar, tr));
+      _mm_storeu_ps(a_im + 2 * m, _mm_sub_ps(ai, ti));
+      _mm_storeu_ps(a_re, _mm_add_ps(ar, tr));
+      _mm_storeu_ps(a_im, _mm_add_ps(ai, ti));
+
+      wr = _mm_loadu_ps(w2_re + j + m), wi = _mm_loadu_ps(w2_im + j + m);
+      tr = _mm_sub_ps(_mm_mul_ps(wr, dr), _mm_mul_ps(wi, di));
+      ti = _mm_add_ps(_mm_mul_ps(wr, di), _mm_mul_ps(wi, dr));
+      _mm_storeu_ps(a_re + 3 * m, _mm_sub_ps(br, tr));
+      _mm_storeu_ps(a_im + 3 * m, _mm_sub_ps(bi, ti));
+      _mm_storeu_ps(a_re + m, _mm_add_ps(br, tr));
+      _mm_storeu_ps(a_im + m, _mm_add_ps(bi, ti));
+    }
+#endif
+    // The first passes have blocks too small for vectors
+    for (; j < m; j++) {
+      size_t a = k + j, b = a + m, c = b + m, d = c + m;
+      float ar = re[a], ai = im[a], br = re[b], bi = im[b];
+      float cr = re[c], ci = im[c], dr = re[d], di = im[d];
+
+      float wr = w1_re[j], wi = w1_im[j];
+      float tr = wr * br - wi * bi, ti = wr * bi + wi * br;
+      br = ar - tr, bi = ai - ti;
+      ar = ar + tr, ai = ai + ti;
+      tr = wr * dr - wi * di, ti = wr * di + wi * dr;
+      dr = cr - tr, di = ci - ti;
+      cr = cr + tr, ci = ci + ti;
+
+      wr = w2_re[j], wi = w2_im[j];
+      tr = wr * cr - wi * ci, ti = wr * ci + wi * cr;
+      re[c] = ar - tr, im[c] = ai - ti;
+      re[a] = ar + tr, im[a] = ai + ti;
+
+      wr = w2_re[j + m], wi = w2_im[j + m];
+      tr = wr * dr - wi * di, ti = wr * di + wi * dr;
+      re[d] = br - tr, im[d] = bi - ti;
+      re[b] = br + tr, im[b] = bi + ti;
+    }
+  }
+}
+
+// The last pass when the number of points is an odd power of two. Only ever
+// combines the two halves, so m is points / 2
+static void radix2_pass(float* re, float* im, const float* w_re, const float* w_im,
+                        size_t m) {
+  const float* w1_re = w_re + m - 1;
+  const float* w1_im = w_im + m - 1;
+
+  size_t j = 0;
+#ifdef __SSE2__
+  for (; j + 4 <= m; j += 4) {
+    __m128 ar = _mm_loadu_ps(re + j), ai = _mm_loadu_ps(im + j);
+    __m128 br = _mm_loadu_ps(re + j + m), bi = _mm_loadu_ps(im + j + m);
+    __m128 wr = _mm_loadu_ps(w1_re + j), wi = _mm_loadu_ps(w1_im + j);
+    __m128 tr = _mm_sub_ps(_mm_mul_ps(wr, br), _mm_mul_ps(wi, bi));
+    __m128 ti = _mm_add_ps(_mm_mul_ps(wr, bi), _mm_mul_ps(wi, br));
+    _mm_storeu_ps(re + j + m, _mm_sub_ps(ar, tr));
+    _mm_storeu_ps(im + j + m, _mm_sub_ps(ai, ti));
+    _mm_storeu_ps(re + j, _mm_add_ps(ar, tr));
+    _mm_storeu_ps(im + j, _mm_add_ps(ai, ti));
+  }
+#endif
+  for (; j < m; j++) {
+    float tr = w1_re[j] * re[j + m] - w1_im[j] * im[j + m];
+    float ti = w1_re[j] * im[j + m] + w1_im[j] * re[j + m];
+    re[j + m] = re[j] - tr, im[j + m] = im[j] - ti;
+    re[j] += tr, im[j] += ti;
+  }
+}
+
+// In place, on points that are already in bit reversed order
+void RealFft::transform() {
+  size_t points = m_size / 2;
+  size_t m = 1;
+  for (; m * 4 <= points; m *= 4)
+    radix4_pass(m_real.data(), m_imag.data(), m_twiddle_real.data(),
+                m_twiddle_imag.data(), points, m);
+  if (m < points)
+    radix2_pass(m_real.data(), m_imag.data(), m_twiddle_real.data(),
+                m_twiddle_imag.data(), m);
+}
+
+void RealFft::power_spectrum(std::span<const float> input, std::span<float> power) {
+  size_t points = m_size / 2;
+
+  // Even samples become the real parts and odd ones the imaginary parts
+  for (size_t i = 0; i < points; i++) {
+    m_real[m_reverse[i]] = input[2 * i];
+    m_imag[m_reverse[i]] = input[2 * i + 1];
+  }
+  transform();
+
+  // Separate the spectra of the even and odd samples (E and O) using the
+  // symmetry of real signals, then combine them: X[k] = E[k] + W^k * O[k]
+  for (size_t k = 0; k < points; k++) {
+    size_t mirror = (points - k) & (points - 1);
+    float zr = m_real[k], zi = m_imag[k];
+    float cr = m_real[mirror], ci = -m_imag[mirror];
+
+    float even_re = (zr + cr) / 2, even_im = (zi + ci) / 2;
+    float odd_re = (zi - ci) / 2, odd_im = -(zr - cr) / 2;
+
+    float xr = even_re + m_split_real[k] * odd_re - m_split_imag[k] * odd_im;
+    float xi = even_im + m_split_real[k] * odd_im + m_split_imag[k] * odd_re;
+    power[k] = xr * xr + xi * xi;
+  }
+}
@@ -3,126 +3,125 @@
 #include "error.h"
 #include "font.h"
 
-FontCache::~FontCache() {
-  TTF_CloseFont(m_font);
-  for (int i = 0; i < m_textures.size(); i++) {
-    SDL_DestroyTexture(m_textures[i]);
+void GlyphTable::insert(unsigned int codepoint, Glyph glyph) {
+  if (codepoint < bmp_size) {
+    std::unique_ptr<Glyph[]>& page = m_pages[codepoint / page_size];
+    if (!page) {
+      page = std::make_unique<Glyph[]>(page_size);
+      for (unsigned int i = 0; i < page_size; i++)
+        page[i].page = -1;
+    }
+    page[codepoint % page_size] = glyph;
+    return;
   }
+
+  // Grow before getting more than half full, so probes stay short
+  if ((m_rare_count + 1) * 2 > m_rare.size()) {
+    std::vector<RareGlyph> old = std::move(m_rare);
+    m_rare.assign(std::max<size_t>(old.size() * 2, 64), {});
+    for (const RareGlyph& rare : old) {
+      if (rare.codepoint != 0)
+        m_rare[rare_slot(rare.codepoint)] = rare;
+    }
+  }
+
+  size_t slot = rare_slot(codepoint);
+  m_rare_count += m_rare[slot].codepoint == 0;
+  m_rare[slot] = {codepoint, glyph};
+}
+
+// The slot holding `codepoint`, or the empty one where it would go
+size_t GlyphTable::rare_slot(unsigned int codepoint) const {
+  size_t mask = m_rare.size() - 1;
+  std::uint32_t hash = codepoint * 0x9E3779B1u;
+  size_t slot = (hash ^ (hash >> 16)) & mask;
+  while (m_rare[slot].codepoint != 0 && m_rare[slot].codepoint != codepoint)
+    slot = (slot + 1) & mask;
+  return slot;
 }
 
-void FontCache::init(SDL_Renderer* renderer, const char* path, int size,
-                     SDL_Color color) {
+const Glyph* GlyphTable::find_rare(unsigned int codepoint) const {
+  if (m_rare.empty())
+    return nullptr;
+  const RareGlyph& rare = m_rare[rare_slot(codepoint)];
+  return rare.codepoint == codepoint ? &rare.glyph : nullptr;
+}
+
+FontCache::FontCache(GlyphAtlas& atlas, const char* path, int size, SDL_Color color)
+    : m_atlas(atlas), m_size(size), m_color(color) {
   if (!TTF_WasInit())
     TTF_Init();
 
-  m_renderer = renderer;
-  m_color = color;
   m_font = TTF_OpenFont(path, size);
   if (m_font == nullptr)
     throw Error(SDL_GetError());
 
-  // The texture size is the largest texture size possible
-  SDL_PropertiesID props = SDL_GetRendererProperties(renderer);
-  m_texture_size =
-      SDL_GetNumberProperty(props, SDL_PROP_RENDERER_MAX_TEXTURE_SIZE_NUMBER, 0);
-  if (m_texture_size <= 0)
-    m_texture_size = 2048; // arbitrary default value
-
-  m_x_offset = 0;
-  m_y_offset = 0;
-  m_texture_offset = 0;
-  m_row_height = 0;
-
   // Fill the cache with the printable ASCII charset (space to tilde)
-  create_new_texture();
   for (uint32_t codepoint = 32; codepoint < 127; codepoint++) {
     get_glyph(codepoint);
   }
 }
 
-void FontCache::render(std::string str, Vec2 p) {
-  using iter = std::string::const_iterator;
-  utf8::iterator<iter> it(str.begin(), str.begin(), str.end());
-  utf8::iterator<iter> end(str.end(), str.begin(), str.end());
+FontCache::~FontCache() { TTF_CloseFont(m_font); }
+
+void FontCache::render(std::string_view str, Vec2 p) {
+  const char* start = str.data();
+  const char* stop = str.data() + str.size();
+  utf8::iterator<const char*> it(start, start, stop);
+  utf8::iterator<const char*> end(stop, start, stop);
   float text_x = p.x;
 
   while (it != end) {
     Glyph glyph = get_glyph(*it);
-    SDL_FRect target_rect = {.x = text_x, .y = p.y, .w = glyph.rect.w, .h = glyph.rect.h};
-    SDL_RenderTexture(m_renderer, m_textures[glyph.texture_offset], &glyph.rect,
-                      &target_rect);
+    m_atlas.draw(glyph, text_x, p.y);
     text_x += glyph.rect.w;
     ++it;
   }
 }
 
 Glyph FontCache::get_glyph(unsigned int codepoint) {
-  if (m_glyphs.contains(codepoint))
-    return m_glyphs[codepoint];
-
-  SDL_Surface* surface = TTF_RenderGlyph_Blended(m_font, codepoint, m_color);
-
-  if (m_x_offset + surface->w >= m_texture_size) {
-    m_y_offset += m_row_height;
-    m_x_offset = 0;
-    m_row_height = 0;
+  // The glyph's size is still right after it's evicted, but it has to be drawn
+  // into the atlas again
+  if (const Glyph* glyph = m_glyphs.find(codepoint)) {
+    if (m_atlas.use(*glyph))
+      return *glyph;
   }
 
-  if (m_y_offset + surface->h >= m_texture_size) {
-    create_new_texture();
-    m_x_offset = 0;
-    m_y_offset = 0;
-    m_texture_offset += 1;
+  SDL_Surface* surface = TTF_RenderGlyph_Blended(m_font, codepoint, m_color);
+  if (!surface) { // Nothing the font can draw, so it takes no space
+    Glyph glyph = {.rect = {0, 0, 0, 0}, .page = 0, .shelf = -1, .generation = 0};
+    m_glyphs.insert(codepoint, glyph);
+    return glyph;
   }
 
-  // Compute the glyph position
-  Glyph glyph = {.rect = {.x = (float)m_x_offset,
-                          .y = (float)m_y_offset,
-                          .w = (float)surface->w,
-                          .h = (float)surface->h},
-                 .texture_offset = m_texture_offset};
-
-  m_row_height = std::max(m_row_height, surface->h);
-  m_x_offset += surface->w;
-
-  // Blit the glyph to its texture
-  SDL_Texture* texture = SDL_CreateTextureFromSurface(m_renderer, surface);
-  SDL_SetRenderTarget(m_renderer, m_textures[glyph.texture_offset]);
-  SDL_RenderTexture(m_renderer, texture, nullptr, &glyph.rect);
-  SDL_SetRenderTarget(m_renderer, nullptr);
+  Glyph glyph = m_atlas.add(surface);
   SDL_DestroySurface(surface);
-  SDL_DestroyTexture(texture);
-
-  m_glyphs.insert({codepoint, glyph});
+  m_glyphs.insert(codepoint, glyph);
   return glyph;
 }
 
-void FontCache::create_new_texture() {
-  SDL_Texture* texture =
-      SDL_CreateTexture(m_renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET,
-                        m_texture_size, m_texture_size);
-  if (texture == nullptr)
-    throw Error(SDL_GetError());
+Vec2 FontCache::text_size(std::string_view str) { return measure(str, nullptr); }
 
-  SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
-  SDL_SetRenderTarget(m_renderer, texture);
-  SDL_SetRenderDrawColor(m_renderer, 0, 0, 0, 255);
-  SDL_RenderClear(m_renderer);
-  SDL_SetRenderTarget(m_renderer, nullptr);
-  m_textures.push_back(texture);
+// Same as above, also filling `advances` with the width of every codepoint
+Vec2 FontCache::text_size(std::string_view str, std::vector<float>& advances) {
+  advances.clear();
+  return measure(str, &advances);
 }
 
-Vec2 FontCache::text_size(std::string str) {
-  using iter = std::string::const_iterator;
-  utf8::iterator<iter> it(str.begin(), str.begin(), str.end());
-  utf8::iterator<iter> end(str.end(), str.begin(), str.end());
+Vec2 FontCache::measure(std::string_view str, std::vector<float>* advances) {
+  const char* start = str.data();
+  const char* stop = str.data() + str.size();
+  utf8::iterator<const char*> it(start, start, stop);
+  utf8::iterator<const char*> end(stop, start, stop);
 
   Vec2 size = {0.0, 0.0};
   while (it != end) {
     Glyph glyph = get_glyph(*it);
+    if (advances)
+      advances->push_back(glyph.rect.w);
     size.x += glyph.rect.w;
     size.y = std::max(glyph.rect.h, size.y);
     ++it;
   }
   return size;
-}
\ No newline at end of file
+}
@@ -3,13 +3,20 @@
 #include <SDL3/SDL_render.h>
 #include <SDL3_image/SDL_image.h>
 #include <SDL3_ttf/SDL_ttf.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <string_view>
 #include <utility>
 
+#include "benchmark.h"
 #include "error.h"
 #include "renderer.h"
 #include "transcriber.h"
 
-void draw_waveform_visualization(Renderer& renderer, std::vector<float>& amplitudes,
+void draw_waveform_visualization(Renderer& renderer, const WaveformView& amplitudes,
                                  float window_width, float window_height) {
   float area_height = 100.0f;
   float area_width = window_width / 1.5f;
@@ -33,6 +40,17 @@ void draw_waveform_visualization(Renderer& renderer, std::vector<float>& amplitu
   }
 }
 
+// Scrolling spectrogram above the waveform, with the same width
+void draw_spectrogram(Renderer& renderer, const Spectrogram& spectrogram,
+                      float window_width, float window_height) {
+  float area_width = window_width / 1.5f;
+  SDL_FRect rect = {.x = (window_width - area_width) / 2.0f,
+                    .y = window_height - 330,
+                    .w = area_width,
+                    .h = 160};
+  renderer.render_spectrogram(spectrogram, rect);
+}
+
 class Cursor {
 public:
   Cursor() {
@@ -119,6 +137,75 @@ private:
   SDL_Texture* m_tex;
 };
 
+void log_vad_stats(Transcriber& engine) {
+  VadStats vad = engine.vad_stats();
+  SDL_Log("Voice activity detection skipped %.1f%% of the audio (%.1fs), saving ~%.1fs "
+          "of decoding",
+          vad.skipped_fraction * 100, vad.skipped_seconds, vad.cpu_seconds_saved);
+}
+
+void log_input_stats(Transcriber& engine) {
+  InputStats input = engine.input_stats();
+  SDL_Log("Input peak %.3f, %llu clipped samples, DC offset %.4f (%s analysis)",
+          input.peak, input.clipped_samples, input.dc_offset, analysis_kernel_name());
+}
+
+void log_recognizer_config(const RecognizerConfig& config) {
+  SDL_Log("Recognizer: %d threads, %s provider, %s (%d paths)%s", config.threads,
+          config.provider.c_str(), config.decoding_method.c_str(),
+          config.max_active_paths, config.int8 ? ", int8 model" : "");
+}
+
+// Transcribe a file without opening a window or an audio device, then print
+// the transcript and how fast it ran. With more than one job, the file is split
+// up and transcribed in parallel
+void transcribe_file(ModelPaths paths, RecognizerConfig config, const char* path,
+                     int jobs) {
+  Transcriber engine(paths, path, StreamMode::Offline, config);
+  OfflineStats stats =
+      jobs > 1 ? engine.transcribe_parallel(jobs) : engine.transcribe_offline();
+
+  TranscriptSnapshotPtr transcript = engine.get_transcript();
+  for (size_t i = 0; i < transcript->line_count; i++)
+    std::cout << transcript->line(i) << "\n";
+
+  SDL_Log("Transcribed %.1fs of audio in %.1fs (real time factor: %.3f)",
+          stats.audio_seconds, stats.wall_seconds, stats.real_time_factor);
+  log_vad_stats(engine);
+  log_recognizer_config(engine.recognizer_config());
+  SDL_Log("Finished in %s decoding mode", decode_mode_name(engine.decode_mode()));
+
+  if (!engine.save_waveform_pyramid())
+    SDL_Log("Failed to save the waveform summaries");
+}
+
+// Load 1, 8 and 32 speech-to-text sessions and log the resident memory of each,
+// to check that they all share one copy of the model weights
+void report_memory(ModelPaths paths, RecognizerConfig config) {
+  SDL_Log("Baseline: %.1f MiB resident", resident_memory() / 1048576.0);
+
+  for (int count : {1, 8, 32}) {
+    std::vector<std::unique_ptr<SpeechToText>> sessions;
+    for (int i = 0; i < count; i++) {
+      sessions.push_back(std::make_unique<SpeechToText>(paths, config));
+      sessions.back()->load();
+    }
+    SDL_Log("%d sessions: %.1f MiB resident", count, resident_memory() / 1048576.0);
+  }
+}
+
+// Model loads can't be interrupted, so one that's still running at exit would
+// keep using onnxruntime while static destructors tear it down. In that case
+// skip the destructors and leave straight away
+int finish(int code) {
+  if (model_threads() > 0) {
+    std::cout.flush();
+    std::fflush(nullptr);
+    std::quick_exit(code);
+  }
+  return code;
+}
+
 // clang-format off
 Clay_RenderCommandArray create_layout() {
   Clay_BeginLayout();
@@ -145,7 +232,7 @@ Clay_RenderCommandArray create_layout() {
 }
 // clang-format on
 
-int main() {
+int main(int argc, char** argv) {
   SDL_Window* window = nullptr;
   SDL_Renderer* renderer = nullptr;
 
@@ -158,7 +245,78 @@ int main() {
         "../assets/sherpa-onnx-streaming-zipformer-en-kroko-2025-08-06/decoder.onnx",
         "../assets/sherpa-onnx-streaming-zipformer-en-kroko-2025-08-06/joiner.onnx",
     };
-    Transcriber engine(paths, "test.wav", true);
+
+    // Usage: didact [--offline <audio file>] [--batch <audio file> [jobs]]
+    //               [--memory-report] [--config <file>] [--threads n]
+    //               [--provider name] [--decoding-method method]
+    //               [--max-active-paths n] [--int8] [--auto-tune]
+    //               [--adaptive true|false] [--rescore-model <dir>]
+    //               [--glyph-memory MiB]
+    //               [--benchmark rope|analysis|text|glyphs|atlas]
+    //               [--benchmark batch|sessions <audio file>]
+    RecognizerConfig config;
+    std::string rescore_model;
+    const char* offline_path = nullptr;
+    const char* model_benchmark = nullptr;
+    int jobs = 1;
+    bool memory_report = false;
+    size_t glyph_memory = GlyphAtlas::default_memory_budget;
+
+    for (int i = 1; i < argc; i++) {
+      std::string_view arg = argv[i];
+      if (arg == "--offline" && i + 1 < argc) {
+        offline_path = argv[++i];
+      } else if (arg == "--batch" && i + 1 < argc) {
+        offline_path = argv[++i];
+        jobs = std::thread::hardware_concurrency();
+        if (i + 1 < argc && !std::string_view(argv[i + 1]).starts_with("--"))
+          jobs = std::atoi(argv[++i]);
+      } else if (arg == "--rescore-model" && i + 1 < argc) {
+        rescore_model = argv[++i];
+      } else if (arg == "--glyph-memory" && i + 1 < argc) {
+        glyph_memory = (size_t)std::max(std::atoi(argv[++i]), 1) << 20;
+      } else if (arg == "--benchmark" && i + 2 < argc &&
+                 is_model_benchmark(argv[i + 1])) {
+        model_benchmark = argv[++i];
+        offline_path = argv[++i];
+      } else if (arg == "--benchmark" && i + 1 < argc) {
+        run_benchmark(argv[++i]);
+        return 0;
+      } else if (arg == "--memory-report") {
+        memory_report = true;
+      } else if (!parse_config_flag(config, argc, argv, i)) {
+        throw Error("Unknown argument: {}", arg);
+      }
+    }
+
+    if (memory_report) {
+      report_memory(paths, config);
+      return finish(0);
+    }
+
+    if (model_benchmark) {
+      run_model_benchmark(model_benchmark, paths, config, offline_path);
+      return finish(0);
+    }
+
+    if (offline_path) {
+      transcribe_file(paths, config, offline_path, jobs);
+      return finish(0);
+    }
+
+    Transcriber engine(paths, "test.wav", StreamMode::Capture, config);
+
+    // A non-streaming transducer model directory, used for a second pass over
+    // every finished line
+    std::string rescore_tokens = rescore_model + "/tokens.txt";
+    std::string rescore_encoder = rescore_model + "/encoder.onnx";
+    std::string rescore_decoder = rescore_model + "/decoder.onnx";
+    std::string rescore_joiner = rescore_model + "/joiner.onnx";
+    if (!rescore_model.empty()) {
+      engine.enable_rescoring({rescore_tokens.c_str(), rescore_encoder.c_str(),
+                               rescore_decoder.c_str(), rescore_joiner.c_str()});
+    }
+
     engine.start();
 
     if (!SDL_Init(SDL_INIT_VIDEO))
@@ -176,11 +334,13 @@ int main() {
     SDL_SetWindowPosition(window, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED);
     SDL_ShowWindow(window);
 
-    Renderer renderer(window, window_width, window_height);
+    Renderer renderer(window, window_width, window_height, glyph_memory);
     Cursor cursor;
 
     SDL_Event event;
     bool running = true;
+    bool loading = true;
+    bool logged_first_transcript = false;
 
     while (running) {
       while (SDL_PollEvent(&event)) {
@@ -213,23 +373,59 @@ int main() {
         }
       }
 
+      // Show the model loading progress in the title bar until it's ready
+      if (loading) {
+        ModelState state = engine.model_state();
+        std::string title = "didact";
+        if (state == ModelState::Loading || state == ModelState::Idle)
+          title += std::format(" (loading the speech model: {}%)",
+                               (int)(engine.model_load_progress() * 100));
+        else if (state == ModelState::Failed)
+          title += " (failed to load the speech model)";
+
+        loading = state == ModelState::Loading || state == ModelState::Idle;
+        SDL_SetWindowTitle(window, title.c_str());
+        if (state == ModelState::Ready)
+          log_recognizer_config(engine.recognizer_config());
+      }
+
+      if (!logged_first_transcript && engine.time_to_first_transcript() >= 0) {
+        SDL_Log("Time to first transcript: %.2fs", engine.time_to_first_transcript());
+        logged_first_transcript = true;
+      }
+
       renderer.clear({0, 0, 0, 255});
 
       auto render_commands = create_layout();
       renderer.render_layout(&render_commands);
 
-      std::vector<float> amplitudes = engine.get_normalized_waveform();
+      WaveformView amplitudes = engine.get_waveform(1024);
       draw_waveform_visualization(renderer, amplitudes, window_width, window_height);
+      draw_spectrogram(renderer, engine.get_spectrogram(), window_width, window_height);
 
       renderer.present();
     }
 
+    log_vad_stats(engine);
+    log_input_stats(engine);
+    if (!engine.save_waveform_pyramid())
+      SDL_Log("Failed to save the waveform summaries");
+    if (!rescore_model.empty()) {
+      RescoreStats rescore = engine.rescore_stats();
+      SDL_Log("Rescored %llu lines, dropped %llu", rescore.rescored_lines,
+              rescore.dropped_lines);
+    }
+
+#ifdef DIDACT_COUNT_ALLOCATIONS
+    SDL_Log("Audio pipeline allocations: %llu", engine.pipeline_allocations());
+#endif
+
   } catch (const std::runtime_error& error) {
     SDL_Log(error.what(), "\n");
-    return -1;
+    return finish(-1);
   }
 
   SDL_DestroyWindow(window);
   SDL_Quit();
-  return 0;
+  return finish(0);
 }
@@ -0,0 +1,134 @@
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <cstdio>
+#include <format>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "model_cache.h"
+
+struct CacheEntry {
+  std::weak_ptr<const SherpaOnnxOnlineRecognizer> recognizer;
+  std::shared_future<RecognizerHandle> loading; // Valid while the model is loading
+};
+
+using Cache = std::unordered_map<std::string, CacheEntry>;
+
+// Leaked on purpose. A model load that's abandoned at exit keeps running on its
+// thread, so these must not be destroyed along with the other statics
+static std::mutex& cache_mutex = *new std::mutex;
+static Cache& cache = *new Cache;
+
+static std::atomic<int> running_model_threads = 0;
+
+// Everything that affects how the recognizer is built
+static std::string cache_key(const SherpaOnnxOnlineRecognizerConfig& c) {
+  auto str = [](const char* s) { return s ? s : ""; };
+  return std::format("{}|{}|{}|{}|{}|{}|{}|{}|{}|{}|{}",
+                     str(c.model_config.tokens), str(c.model_config.transducer.encoder),
+                     str(c.model_config.transducer.decoder),
+                     str(c.model_config.transducer.joiner), c.model_config.num_threads,
+                     str(c.model_config.provider), str(c.decoding_method),
+                     c.max_active_paths, c.rule1_min_trailing_silence,
+                     c.rule2_min_trailing_silence, c.rule3_min_utterance_length);
+}
+
+RecognizerHandle acquire_recognizer(const SherpaOnnxOnlineRecognizerConfig& config) {
+  std::string key = cache_key(config);
+  std::promise<RecognizerHandle> loaded;
+  std::shared_future<RecognizerHandle> loading;
+
+  // Only held around the lookup and the insert. Callers asking for a model
+  // that's already loading wait on that load instead of holding up the others
+  {
+    std::lock_guard<std::mutex> guard(cache_mutex);
+    std::erase_if(cache, [](const auto& item) {
+      return item.second.recognizer.expired() && !item.second.loading.valid();
+    });
+
+    CacheEntry& entry = cache[key];
+    if (RecognizerHandle recognizer = entry.recognizer.lock())
+      return recognizer;
+
+    if (entry.loading.valid())
+      loading = entry.loading;
+    else
+      entry.loading = loaded.get_future().share();
+  }
+  if (loading.valid())
+    return loading.get();
+
+  // Warm the page cache with every model file at once, instead of letting
+  // onnxruntime read them one after the other
+  std::vector<std::jthread> prefetchers;
+  for (const char* path :
+       {config.model_config.transducer.encoder, config.model_config.transducer.decoder,
+        config.model_config.transducer.joiner, config.model_config.tokens}) {
+    if (path)
+      prefetchers.emplace_back(prefetch_model_file, path);
+  }
+  prefetchers.clear();
+
+  RecognizerHandle recognizer;
+  if (const SherpaOnnxOnlineRecognizer* ptr = SherpaOnnxCreateOnlineRecognizer(&config))
+    recognizer = RecognizerHandle(ptr, SherpaOnnxDestroyOnlineRecognizer);
+
+  {
+    std::lock_guard<std::mutex> guard(cache_mutex);
+    CacheEntry& entry = cache[key];
+    entry.recognizer = recognizer;
+    entry.loading = {};
+  }
+  loaded.set_value(recognizer);
+  return recognizer;
+}
+
+void begin_model_thread() { running_model_threads++; }
+
+void end_model_thread() { running_model_threads--; }
+
+int model_threads() { return running_model_threads; }
+
+#ifdef __linux__
+void prefetch_model_file(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return;
+
+  struct stat info;
+  if (fstat(fd, &info) == 0 && info.st_size > 0) {
+    void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (data != MAP_FAILED) {
+      madvise(data, info.st_size, MADV_WILLNEED);
+      munmap(data, info.st_size);
+    }
+  }
+  close(fd);
+}
+
+size_t resident_memory() {
+  FILE* file = fopen("/proc/self/statm", "r");
+  if (!file)
+    return 0;
+
+  unsigned long size = 0, resident = 0;
+  int matched = fscanf(file, "%lu %lu", &size, &resident);
+  fclose(file);
+  return matched == 2 ? resident * sysconf(_SC_PAGESIZE) : 0;
+}
+#else
+// Onnxruntime reads the files itself, just without the head start
+void prefetch_model_file(const char*) {}
+
+size_t resident_memory() { return 0; }
+#endif
@@ -2,17 +2,29 @@
 #include "renderer.h"
 #include "error.h"
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <math.h>
 
-Renderer::Renderer(SDL_Window* window, float window_width, float window_height) {
+// Fonts by Clay font id, and the size used when a text doesn't set one
+static const char* font_paths[] = {"../assets/Roboto-Regular.ttf"};
+static const std::uint16_t default_font_size = 18;
+
+Renderer::Renderer(SDL_Window* window, float window_width, float window_height,
+                   size_t glyph_memory_budget) {
   // Initialize the renderer and font cache
   m_renderer = SDL_CreateRenderer(window, nullptr);
   if (!m_renderer)
     throw Error(SDL_GetError());
 
   SDL_SetRenderVSync(m_renderer, 1);
-  m_font.init(m_renderer, "../assets/Roboto-Regular.ttf", 18, {255, 255, 255, 255});
+  auto font_start = std::chrono::steady_clock::now();
+  m_atlas = std::make_unique<GlyphAtlas>(m_renderer, glyph_memory_budget);
+  font(0, default_font_size);
+  std::chrono::duration<double, std::milli> font_time =
+      std::chrono::steady_clock::now() - font_start;
+  SDL_Log("Font cache initialized in %.2fms", font_time.count());
 
   // Initialize the layout
   unsigned int memsize = Clay_MinMemorySize();
@@ -25,29 +37,119 @@ Renderer::Renderer(SDL_Window* window, float window_width, float window_height)
 
   auto measure_text = [](Clay_StringSlice text, Clay_TextElementConfig* config,
                          void* data) {
-    // TODO: adjust using `config`
     Renderer* renderer = (Renderer*)data;
-    std::string str(text.chars, text.length);
-    Vec2 size = renderer->m_font.text_size(str);
+    std::string_view str(text.chars, text.length);
+    FontCache& font = renderer->font(config->fontId, config->fontSize);
+    Vec2 size =
+        renderer->m_measured.measure(font, str, config->fontId, font.size()).size;
     return (Clay_Dimensions){size.x, size.y};
   };
   Clay_SetMeasureTextFunction(measure_text, this);
 }
 
-Renderer::~Renderer() { SDL_DestroyRenderer(m_renderer); }
+Renderer::~Renderer() {
+  m_fonts.clear();
+  m_atlas.reset();
+  if (m_spectrogram_texture)
+    SDL_DestroyTexture(m_spectrogram_texture);
+  SDL_DestroyRenderer(m_renderer);
+}
 
 void Renderer::clear(SDL_FColor color) {
   SDL_SetRenderDrawColor(m_renderer, color.r, color.g, color.b, color.a);
   SDL_RenderClear(m_renderer);
 }
 
-void Renderer::present() { SDL_RenderPresent(m_renderer); }
+void Renderer::present() {
+  m_atlas->flush();
+  m_atlas->end_frame();
+  SDL_RenderPresent(m_renderer);
+}
+
+void Renderer::render_text(std::string_view text, Vec2 position,
+                           std::uint16_t font_id, std::uint16_t font_size) {
+  font(font_id, font_size).render(text, position);
+}
+
+// The font cache for a font and size, opened the first time it's used. There
+// are only ever a few, so they're found by a linear search
+FontCache& Renderer::font(std::uint16_t font_id, std::uint16_t font_size) {
+  if (font_id >= std::size(font_paths))
+    font_id = 0;
+  if (font_size == 0)
+    font_size = default_font_size;
+
+  for (LoadedFont& font : m_fonts) {
+    if (font.id == font_id && font.size == font_size)
+      return *font.cache;
+  }
+
+  SDL_Color white = {255, 255, 255, 255};
+  auto cache =
+      std::make_unique<FontCache>(*m_atlas, font_paths[font_id], font_size, white);
+  m_fonts.push_back({font_id, font_size, std::move(cache)});
+  return *m_fonts.back().cache;
+}
 
 void Renderer::render_rectangle(SDL_FRect rect, SDL_FColor color) {
+  m_atlas->flush(); // Keep text that was drawn before it underneath
   SDL_SetRenderDrawColor(m_renderer, color.r, color.g, color.b, color.a);
   SDL_RenderFillRect(m_renderer, &rect);
 }
 
+// Upload the columns added since the last frame, then draw the texture in two
+// parts so the oldest column ends up on the left. Costs O(new columns) instead
+// of re-uploading the whole image every frame
+void Renderer::render_spectrogram(const Spectrogram& spectrogram, SDL_FRect rect) {
+  const int width = Spectrogram::visible_columns;
+  const int height = Spectrogram::height;
+  m_atlas->flush(); // Keep text that was drawn before it underneath
+  if (!m_spectrogram_texture) {
+    m_spectrogram_texture = SDL_CreateTexture(m_renderer, SDL_PIXELFORMAT_XRGB8888,
+                                              SDL_TEXTUREACCESS_STREAMING, width, height);
+    if (!m_spectrogram_texture)
+      throw Error(SDL_GetError());
+
+    m_spectrogram_pixels.assign(width * height, 0);
+    SDL_UpdateTexture(m_spectrogram_texture, nullptr, m_spectrogram_pixels.data(),
+                      width * sizeof(Uint32));
+  }
+
+  // Columns that scrolled out of view before being uploaded are skipped
+  Uint64 written = spectrogram.columns_written();
+  Uint64 next =
+      std::max<Uint64>(m_spectrogram_uploaded, written > width ? written - width : 0);
+
+  // At most two runs, since the columns wrap around the end of the texture
+  while (next < written) {
+    int x = next % width;
+    int count = std::min<Uint64>(written - next, width - x);
+    for (int i = 0; i < count; i++) {
+      const Uint32* column = spectrogram.column(next + i);
+      for (int y = 0; y < height; y++)
+        m_spectrogram_pixels[y * width + x + i] = column[y];
+    }
+
+    SDL_Rect dirty = {x, 0, count, height};
+    SDL_UpdateTexture(m_spectrogram_texture, &dirty, &m_spectrogram_pixels[x],
+                      width * sizeof(Uint32));
+    next += count;
+  }
+  m_spectrogram_uploaded = written;
+
+  // The oldest column is the one that gets written over next
+  float oldest = written % width;
+  float split = rect.w * (width - oldest) / width;
+  SDL_FRect older_source = {oldest, 0, width - oldest, (float)height};
+  SDL_FRect older = {rect.x, rect.y, split, rect.h};
+  SDL_RenderTexture(m_renderer, m_spectrogram_texture, &older_source, &older);
+  if (oldest > 0) {
+    SDL_FRect newer_source = {0, 0, oldest, (float)height};
+    SDL_FRect newer = {rect.x + split, rect.y, rect.w - split, rect.h};
+    SDL_RenderTexture(m_renderer, m_spectrogram_texture, &newer_source, &newer);
+  }
+}
+
 void Renderer::render_round_rect(float x, float y, float w, float h, float radius,
                                  SDL_FColor color) {
   // Draw the base rectangles
@@ -100,8 +202,19 @@ void Renderer::render_round_rect(float x, float y, float w, float h, float radiu
   }
 }
 
+// Glyphs are queued up and drawn together, once per run of text commands, so
+// the layout is layered in command order: under anything drawn after it
 void Renderer::render_layout(Clay_RenderCommandArray* commands) {
   for (int i = 0; i < commands->length; i++) {
     Clay_RenderCommand* cmd = Clay_RenderCommandArray_Get(commands, i);
+    if (cmd->commandType == CLAY_RENDER_COMMAND_TYPE_TEXT) {
+      Clay_StringSlice text = cmd->renderData.text.stringContents;
+      Clay_TextRenderData& data = cmd->renderData.text;
+      render_text({text.chars, (size_t)text.length},
+                  {cmd->boundingBox.x, cmd->boundingBox.y}, data.fontId, data.fontSize);
+    } else {
+      m_atlas->flush(); // The text run ended
+    }
   }
+  m_atlas->flush();
 }
\ No newline at end of file
@@ -0,0 +1,156 @@
+#include <sched.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "rescorer.h"
+
+AudioHistory::AudioHistory(size_t capacity) : m_samples(capacity) {}
+
+void AudioHistory::push(std::span<const float> samples) {
+  std::lock_guard<std::mutex> guard(m_mutex);
+  size_t capacity = m_samples.size();
+  size_t kept = std::min(samples.size(), capacity);
+  m_end += samples.size() - kept; // Would be overwritten straight away
+  for (float sample : samples.last(kept))
+    m_samples[m_end++ % capacity] = sample;
+}
+
+bool AudioHistory::copy(u64 start, u64 end, std::vector<float>& output) {
+  std::lock_guard<std::mutex> guard(m_mutex);
+  size_t capacity = m_samples.size();
+  end = std::min(end, m_end);
+  if (start > end || m_end - start > capacity)
+    return false;
+
+  output.resize(end - start);
+  for (u64 i = start; i < end; i++)
+    output[i - start] = m_samples[i % capacity];
+  return true;
+}
+
+// Lowest scheduling class, so the kernel only runs this thread on otherwise
+// idle cores
+static void lower_thread_priority() {
+#ifdef __linux__
+  sched_param param = {};
+  sched_setscheduler(0, SCHED_IDLE, &param);
+#endif
+}
+
+// Copies of the model paths for the worker, which can outlive the strings the
+// caller's ModelPaths point to
+struct OfflineModelFiles {
+  std::string tokens;
+  std::string encoder;
+  std::string decoder;
+  std::string joiner;
+};
+
+static void rescore_loop(std::shared_ptr<RescoreQueue> queue,
+                         const OfflineModelFiles& files) {
+  lower_thread_priority();
+
+  SherpaOnnxOfflineRecognizerConfig config;
+  std::memset(&config, 0, sizeof(config));
+  config.feat_config.sample_rate = 16000;
+  config.feat_config.feature_dim = 80;
+  config.model_config.transducer.encoder = files.encoder.c_str();
+  config.model_config.transducer.decoder = files.decoder.c_str();
+  config.model_config.transducer.joiner = files.joiner.c_str();
+  config.model_config.tokens = files.tokens.c_str();
+  config.model_config.num_threads = 1;
+  config.model_config.provider = "cpu";
+  config.decoding_method = "modified_beam_search";
+  config.max_active_paths = 4;
+
+  const SherpaOnnxOfflineRecognizer* recognizer =
+      SherpaOnnxCreateOfflineRecognizer(&config);
+
+  while (true) {
+    RescoreJob job;
+    {
+      std::unique_lock<std::mutex> guard(queue->mutex);
+      queue->done.wait(guard, [&] { return queue->stopped || !queue->jobs.empty(); });
+      if (queue->stopped || !recognizer)
+        break;
+
+      job = std::move(queue->jobs.front());
+      queue->jobs.pop_front();
+    }
+
+    const SherpaOnnxOfflineStream* stream = SherpaOnnxCreateOfflineStream(recognizer);
+    SherpaOnnxAcceptWaveformOffline(stream, 16000, job.samples.data(),
+                                    job.samples.size());
+    SherpaOnnxDecodeOfflineStream(recognizer, stream);
+    const SherpaOnnxOfflineRecognizerResult* r =
+        SherpaOnnxGetOfflineStreamResult(stream);
+
+    {
+      // Called with the lock held, so the rescorer can't be destroyed meanwhile
+      std::lock_guard<std::mutex> guard(queue->mutex);
+      if (!queue->stopped && r->text[0] != '\0') {
+        queue->handler(queue->user_data, job.line, r->text);
+        queue->rescored++;
+      }
+    }
+
+    SherpaOnnxDestroyOfflineRecognizerResult(r);
+    SherpaOnnxDestroyOfflineStream(stream);
+  }
+
+  if (recognizer)
+    SherpaOnnxDestroyOfflineRecognizer(recognizer);
+}
+
+Rescorer::Rescorer(ModelPaths offline_paths, RescoreHandler handler, void* user_data,
+                   size_t capacity) {
+  m_queue = std::make_shared<RescoreQueue>();
+  m_queue->capacity = std::max(capacity, (size_t)1);
+  m_queue->handler = handler;
+  m_queue->user_data = user_data;
+
+  // The model loads on the worker too, at idle priority. Joining would make
+  // shutdown wait for a load or decode to finish, see model_threads()
+  OfflineModelFiles files = {offline_paths.tokens, offline_paths.encoder,
+                             offline_paths.decoder, offline_paths.joiner};
+  begin_model_thread();
+  std::thread worker([queue = m_queue, files = std::move(files)]() mutable {
+    rescore_loop(std::move(queue), files);
+    end_model_thread();
+  });
+  worker.detach();
+}
+
+Rescorer::~Rescorer() {
+  std::lock_guard<std::mutex> guard(m_queue->mutex);
+  m_queue->stopped = true;
+  m_queue->jobs.clear();
+  m_queue->done.notify_all();
+}
+
+// Queue a finished utterance (16 kHz) to be rescored. Never blocks; if the
+// queue is full, the oldest job is dropped instead
+void Rescorer::submit(size_t line, std::vector<float> samples) {
+  std::lock_guard<std::mutex> guard(m_queue->mutex);
+  if (m_queue->jobs.size() >= m_queue->capacity) {
+    m_queue->jobs.pop_front();
+    m_queue->dropped++;
+  }
+
+  m_queue->jobs.push_back({line, std::move(samples)});
+  m_queue->done.notify_one();
+}
+
+u64 Rescorer::dropped_jobs() {
+  std::lock_guard<std::mutex> guard(m_queue->mutex);
+  return m_queue->dropped;
+}
+
+u64 Rescorer::rescored_lines() {
+  std::lock_guard<std::mutex> guard(m_queue->mutex);
+  return m_queue->rescored;
+}
@@ -0,0 +1,294 @@
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "rope.h"
+
+// Leaves are kept small so edits copy little, but not so small that the tree
+// gets deep
+static const size_t max_leaf_size = 1024;
+
+static bool is_continuation(char c) { return ((unsigned char)c & 0xC0) == 0x80; }
+
+static int height(const RopeNodePtr& node) { return node ? node->height : -1; }
+
+static size_t bytes(const RopeNodePtr& node) { return node ? node->bytes : 0; }
+
+static RopeNodePtr make_leaf(std::string text) {
+  if (text.empty())
+    return nullptr;
+
+  auto leaf = std::make_shared<RopeNode>();
+  leaf->bytes = text.size();
+  leaf->codepoints = 0;
+  leaf->newlines = 0;
+  for (char c : text) {
+    leaf->codepoints += !is_continuation(c);
+    leaf->newlines += c == '\n';
+  }
+  leaf->height = 0;
+  leaf->text = std::move(text);
+  return leaf;
+}
+
+static RopeNodePtr make_node(RopeNodePtr left, RopeNodePtr right) {
+  if (!left)
+    return right;
+  if (!right)
+    return left;
+
+  auto node = std::make_shared<RopeNode>();
+  node->bytes = left->bytes + right->bytes;
+  node->codepoints = left->codepoints + right->codepoints;
+  node->newlines = left->newlines + right->newlines;
+  node->height = std::max(left->height, right->height) + 1;
+  node->left = std::move(left);
+  node->right = std::move(right);
+  return node;
+}
+
+// Join two subtrees whose heights differ by at most two, rotating if needed
+static RopeNodePtr balance(RopeNodePtr left, RopeNodePtr right) {
+  if (height(left) > height(right) + 1) {
+    if (height(left->left) >= height(left->right))
+      return make_node(left->left, make_node(left->right, right));
+    return make_node(make_node(left->left, left->right->left),
+                     make_node(left->right->right, right));
+  }
+
+  if (height(right) > height(left) + 1) {
+    if (height(right->right) >= height(right->left))
+      return make_node(make_node(left, right->left), right->right);
+    return make_node(make_node(left, right->left->left),
+                     make_node(right->left->right, right->right));
+  }
+
+  return make_node(left, right);
+}
+
+// Concatenate two trees. Costs O(height difference), and merges neighbouring
+// leaves that are small enough, so repeated edits don't leave lots of tiny ones
+static RopeNodePtr join(RopeNodePtr left, RopeNodePtr right) {
+  if (!left)
+    return right;
+  if (!right)
+    return left;
+
+  if (left->height == 0 && right->height == 0 &&
+      left->bytes + right->bytes <= max_leaf_size)
+    return make_leaf(left->text + right->text);
+
+  if (height(left) > height(right) + 1)
+    return balance(left->left, join(left->right, right));
+  if (height(right) > height(left) + 1)
+    return balance(join(left, right->left), right->right);
+  return make_node(left, right);
+}
+
+// Split into the text before and after `offset`, which is moved back to the
+// start of its codepoint
+static std::pair<RopeNodePtr, RopeNodePtr> split(const RopeNodePtr& node, size_t offset) {
+  if (!node)
+    return {nullptr, nullptr};
+  if (offset == 0)
+    return {nullptr, node};
+  if (offset >= node->bytes)
+    return {node, nullptr};
+
+  if (node->height == 0) {
+    while (offset > 0 && is_continuation(node->text[offset]))
+      offset--;
+    return {make_leaf(node->text.substr(0, offset)),
+            make_leaf(node->text.substr(offset))};
+  }
+
+  if (offset <= node->left->bytes) {
+    auto [left, right] = split(node->left, offset);
+    return {left, join(right, node->right)};
+  }
+
+  auto [left, right] = split(node->right, offset - node->left->bytes);
+  return {join(node->left, left), right};
+}
+
+// Cut text into leaves at codepoint boundaries and build a balanced tree of them
+static RopeNodePtr build(std::string_view text) {
+  std::vector<RopeNodePtr> level;
+  while (!text.empty()) {
+    size_t length = std::min(text.size(), max_leaf_size);
+    while (length < text.size() && length > 1 && is_continuation(text[length]))
+      length--;
+    level.push_back(make_leaf(std::string(text.substr(0, length))));
+    text.remove_prefix(length);
+  }
+
+  while (level.size() > 1) {
+    std::vector<RopeNodePtr> next;
+    for (size_t i = 0; i < level.size(); i += 2)
+      next.push_back(i + 1 < level.size() ? make_node(level[i], level[i + 1]) : level[i]);
+    level = std::move(next);
+  }
+  return level.empty() ? nullptr : level[0];
+}
+
+Rope::Rope(std::string_view text) : m_root(build(text)) {}
+
+size_t Rope::size() const { return bytes(m_root); }
+
+size_t Rope::codepoint_count() const { return m_root ? m_root->codepoints : 0; }
+
+size_t Rope::line_count() const { return (m_root ? m_root->newlines : 0) + 1; }
+
+bool Rope::empty() const { return !m_root; }
+
+void Rope::insert(size_t offset, std::string_view text) {
+  if (text.empty())
+    return;
+  auto [left, right] = split(m_root, offset);
+  m_root = join(join(left, build(text)), right);
+}
+
+void Rope::erase(size_t offset, size_t length) {
+  if (length == 0)
+    return;
+  auto [left, rest] = split(m_root, offset);
+  auto [removed, right] = split(rest, length);
+  m_root = join(left, right);
+}
+
+void Rope::append(std::string_view text) { insert(size(), text); }
+
+char Rope::at(size_t offset) const {
+  const RopeNode* node = m_root.get();
+  while (node->height > 0) {
+    if (offset < node->left->bytes) {
+      node = node->left.get();
+    } else {
+      offset -= node->left->bytes;
+      node = node->right.get();
+    }
+  }
+  return node->text[offset];
+}
+
+static void collect(const RopeNode* node, size_t start, size_t end, std::string& output) {
+  if (!node || start >= end)
+    return;
+  if (node->height == 0) {
+    output.append(node->text, start, end - start);
+    return;
+  }
+
+  size_t left_bytes = node->left->bytes;
+  collect(node->left.get(), start, std::min(end, left_bytes), output);
+  if (end > left_bytes)
+    collect(node->right.get(), start > left_bytes ? start - left_bytes : 0,
+            end - left_bytes, output);
+}
+
+std::string Rope::substr(size_t offset, size_t length) const {
+  std::string output;
+  size_t end = std::min(size(), offset + std::min(length, size()));
+  if (offset < end) {
+    output.reserve(end - offset);
+    collect(m_root.get(), offset, end, output);
+  }
+  return output;
+}
+
+std::string Rope::to_string() const { return substr(0, size()); }
+
+// Byte offset where a line starts. Lines past the end start at the end
+size_t Rope::line_start(size_t line) const {
+  if (line == 0 || !m_root)
+    return 0;
+  if (line > m_root->newlines)
+    return size();
+
+  // Find the line'th newline, then step past it
+  const RopeNode* node = m_root.get();
+  size_t offset = 0;
+  while (node->height > 0) {
+    if (node->left->newlines >= line) {
+      node = node->left.get();
+    } else {
+      line -= node->left->newlines;
+      offset += node->left->bytes;
+      node = node->right.get();
+    }
+  }
+
+  for (size_t i = 0; i < node->text.size(); i++) {
+    if (node->text[i] == '\n' && --line == 0)
+      return offset + i + 1;
+  }
+  return offset + node->text.size();
+}
+
+// Count newlines and codepoints before `offset`
+static void count_before(const RopeNode* node, size_t offset, size_t& newlines,
+                         size_t& codepoints) {
+  newlines = 0;
+  codepoints = 0;
+  while (node && node->height > 0) {
+    if (offset < node->left->bytes) {
+      node = node->left.get();
+    } else {
+      offset -= node->left->bytes;
+      newlines += node->left->newlines;
+      codepoints += node->left->codepoints;
+      node = node->right.get();
+    }
+  }
+
+  if (!node)
+    return;
+  for (size_t i = 0; i < std::min(offset, node->text.size()); i++) {
+    newlines += node->text[i] == '\n';
+    codepoints += !is_continuation(node->text[i]);
+  }
+}
+
+LineColumn Rope::position(size_t offset) const {
+  offset = std::min(offset, size());
+  size_t newlines = 0, codepoints = 0;
+  count_before(m_root.get(), offset, newlines, codepoints);
+
+  size_t line_newlines = 0, line_codepoints = 0;
+  count_before(m_root.get(), line_start(newlines), line_newlines, line_codepoints);
+  return {newlines, codepoints - line_codepoints};
+}
+
+// Byte offset of a line and column (in codepoints). Columns past the end of
+// the line are clamped to it
+size_t Rope::offset(size_t line, size_t column) const {
+  size_t start = line_start(line);
+  size_t end = line + 1 < line_count() ? line_start(line + 1) - 1 : size();
+
+  size_t newlines = 0, codepoints = 0;
+  count_before(m_root.get(), start, newlines, codepoints);
+  size_t target = codepoints + column;
+
+  // Find the byte where codepoint number `target` starts
+  const RopeNode* node = m_root.get();
+  size_t offset = 0;
+  while (node && node->height > 0) {
+    if (target < node->left->codepoints) {
+      node = node->left.get();
+    } else {
+      target -= node->left->codepoints;
+      offset += node->left->bytes;
+      node = node->right.get();
+    }
+  }
+
+  if (node) {
+    size_t i = 0;
+    for (; i < node->text.size(); i++) {
+      if (!is_continuation(node->text[i]) && target-- == 0)
+        break;
+    }
+    offset += i;
+  }
+  return std::min(offset, end);
+}
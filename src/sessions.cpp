@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <utility>
+
+#include "error.h"
+#include "sessions.h"
+
+SessionScheduler::SessionScheduler(SpeechToText& stt) {
+  stt.load();
+  m_recognizer_handle = stt.recognizer();
+  m_recognizer = m_recognizer_handle.get();
+  m_new_audio = false;
+  m_batches = 0;
+  m_streams_decoded = 0;
+  m_max_batch_size = 0;
+  m_thread = std::jthread([this](std::stop_token token) { run(token); });
+}
+
+SessionScheduler::~SessionScheduler() {
+  m_thread.request_stop();
+  m_thread.join();
+
+  for (std::shared_ptr<Session>& session : m_sessions) {
+    if (session && session->stream)
+      SherpaOnnxDestroyOnlineStream(session->stream);
+  }
+}
+
+SessionId SessionScheduler::open_session(TextHandler handler, void* user_data) {
+  auto session = std::make_shared<Session>();
+  session->stream = SherpaOnnxCreateOnlineStream(m_recognizer);
+  session->handler = handler;
+  session->user_data = user_data;
+  session->closed = false;
+  session->waiting = false;
+  session->measuring = false;
+  session->results = 0;
+  session->total_latency_ms = 0;
+  session->max_latency_ms = 0;
+
+  std::lock_guard<std::mutex> guard(m_mutex);
+  m_sessions.push_back(session);
+  return m_sessions.size() - 1;
+}
+
+// The stream is destroyed by the scheduler thread, the next time it wakes up
+void SessionScheduler::close_session(SessionId id) {
+  std::shared_ptr<Session> session = get_session(id);
+  {
+    std::lock_guard<std::mutex> guard(session->mutex);
+    if (session->closed)
+      throw Error("Session {} is already closed", id);
+    session->closed = true;
+  }
+
+  std::lock_guard<std::mutex> guard(m_mutex);
+  m_new_audio = true;
+  m_have_audio.notify_one();
+}
+
+void SessionScheduler::accept_samples(SessionId id, float* samples, int num_samples) {
+  std::shared_ptr<Session> session = get_session(id);
+  {
+    std::lock_guard<std::mutex> guard(session->mutex);
+    if (session->closed)
+      throw Error("Session {} is closed", id);
+
+    session->pending.insert(session->pending.end(), samples, samples + num_samples);
+    if (!session->waiting) {
+      session->waiting = true;
+      session->waiting_since = Clock::now();
+    }
+  }
+
+  std::lock_guard<std::mutex> guard(m_mutex);
+  m_new_audio = true;
+  m_have_audio.notify_one();
+}
+
+SessionStats SessionScheduler::session_stats(SessionId id) {
+  std::shared_ptr<Session> session = get_session(id);
+  std::lock_guard<std::mutex> guard(session->mutex);
+
+  SessionStats stats;
+  stats.results = session->results;
+  stats.average_latency_ms =
+      session->results > 0 ? session->total_latency_ms / session->results : 0;
+  stats.max_latency_ms = session->max_latency_ms;
+  return stats;
+}
+
+BatchStats SessionScheduler::batch_stats() {
+  std::lock_guard<std::mutex> guard(m_mutex);
+  BatchStats stats;
+  stats.batches = m_batches;
+  stats.streams_decoded = m_streams_decoded;
+  stats.max_batch_size = m_max_batch_size;
+  stats.average_batch_size = m_batches > 0 ? (double)m_streams_decoded / m_batches : 0;
+  return stats;
+}
+
+std::shared_ptr<SessionScheduler::Session> SessionScheduler::get_session(SessionId id) {
+  std::lock_guard<std::mutex> guard(m_mutex);
+  std::shared_ptr<Session> session = m_sessions.at(id);
+  if (!session)
+    throw Error("Session {} is closed", id);
+  return session;
+}
+
+// Move the session's pending audio into its stream. Returns false if the
+// session was closed. Only called on the scheduler thread
+bool SessionScheduler::feed_stream(Session& session) {
+  {
+    std::lock_guard<std::mutex> guard(session.mutex);
+    if (session.closed)
+      return false;
+
+    std::swap(session.pending, session.feeding);
+    if (session.waiting && !session.measuring) {
+      session.measuring = true;
+      session.fed_since = session.waiting_since;
+    }
+    session.waiting = false;
+  }
+
+  if (!session.feeding.empty()) {
+    SherpaOnnxOnlineStreamAcceptWaveform(session.stream, 16000, session.feeding.data(),
+                                         session.feeding.size());
+    session.feeding.clear();
+  }
+  return true;
+}
+
+void SessionScheduler::run(std::stop_token token) {
+  std::vector<std::shared_ptr<Session>> sessions;
+  std::vector<std::shared_ptr<Session>> batch;
+  std::vector<const SherpaOnnxOnlineStream*> streams;
+  std::vector<Result> results;
+
+  while (!token.stop_requested()) {
+    {
+      // Wait until some session got new audio, or was closed
+      std::unique_lock<std::mutex> guard(m_mutex);
+      if (!m_have_audio.wait(guard, token, [&] { return m_new_audio; }))
+        break; // A stop was requested
+
+      m_new_audio = false;
+      sessions = m_sessions;
+    }
+
+    // Keep decoding batches until no stream has enough audio left
+    while (!token.stop_requested()) {
+      batch.clear();
+      streams.clear();
+      results.clear();
+
+      for (size_t id = 0; id < sessions.size(); id++) {
+        std::shared_ptr<Session>& session = sessions[id];
+        if (!session)
+          continue;
+
+        if (!feed_stream(*session)) {
+          SherpaOnnxOnlineStreamInputFinished(session->stream);
+          SherpaOnnxDestroyOnlineStream(session->stream);
+          session->stream = nullptr;
+          session = nullptr;
+
+          std::lock_guard<std::mutex> guard(m_mutex);
+          m_sessions[id] = nullptr;
+          continue;
+        }
+
+        if (SherpaOnnxIsOnlineStreamReady(m_recognizer, session->stream)) {
+          batch.push_back(session);
+          streams.push_back(session->stream);
+        }
+      }
+
+      if (batch.empty())
+        break;
+      SherpaOnnxDecodeMultipleOnlineStreams(m_recognizer, streams.data(), streams.size());
+
+      for (std::shared_ptr<Session>& session : batch) {
+        const SherpaOnnxOnlineRecognizerResult* r =
+            SherpaOnnxGetOnlineStreamResult(m_recognizer, session->stream);
+        results.push_back({session, r->text, false});
+        SherpaOnnxDestroyOnlineRecognizerResult(r);
+
+        if (SherpaOnnxOnlineStreamIsEndpoint(m_recognizer, session->stream)) {
+          SherpaOnnxOnlineStreamReset(m_recognizer, session->stream);
+          results.back().endpoint = true;
+        }
+
+        if (session->measuring) {
+          std::chrono::duration<double, std::milli> latency =
+              Clock::now() - session->fed_since;
+          session->measuring = false;
+
+          std::lock_guard<std::mutex> guard(session->mutex);
+          session->results++;
+          session->total_latency_ms += latency.count();
+          session->max_latency_ms = std::max(session->max_latency_ms, latency.count());
+        }
+      }
+
+      {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_batches++;
+        m_streams_decoded += batch.size();
+        m_max_batch_size = std::max(m_max_batch_size, batch.size());
+      }
+
+      // No locks are held, so handlers are free to call back into the scheduler
+      for (Result& result : results)
+        result.session->handler(result.session->user_data, std::move(result.text),
+                                result.endpoint);
+    }
+  }
+}
@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+#include "spectrogram.h"
+
+// The loudest and quietest levels shown, relative to a full scale sine
+static const float top_db = 0.0f;
+static const float floor_db = -100.0f;
+
+// Black through blue, red and yellow to white, so quiet noise stays dark and
+// strong tones stand out
+static std::uint32_t palette_color(float position) {
+  static const float stops[][3] = {{0, 0, 0},     {20, 10, 90},   {150, 20, 120},
+                                   {240, 80, 30}, {255, 220, 40}, {255, 255, 255}};
+  const int last = std::size(stops) - 1;
+
+  float scaled = std::clamp(position, 0.0f, 1.0f) * last;
+  int index = std::min((int)scaled, last - 1);
+  float t = scaled - index;
+  std::uint32_t color = 0;
+  for (int channel = 0; channel < 3; channel++) {
+    float from = stops[index][channel], to = stops[index + 1][channel];
+    float value = from + (to - from) * t;
+    color = (color << 8) | (std::uint32_t)std::lround(value);
+  }
+  return color;
+}
+
+Spectrogram::Spectrogram(std::uint32_t sample_rate)
+    : m_sample_rate(sample_rate), m_samples(1 << 15), m_fft(fft_size) {
+  m_hop.resize(hop_size);
+  m_window.resize(fft_size);
+  m_windowed.resize(fft_size);
+  m_power.resize(fft_size / 2);
+
+  m_hann.resize(fft_size);
+  for (size_t i = 0; i < fft_size; i++)
+    m_hann[i] = 0.5f - 0.5f * std::cos(2 * std::numbers::pi * i / fft_size);
+
+  for (int i = 0; i < 256; i++)
+    m_palette[i] = palette_color(i / 255.0f);
+
+  m_columns = std::make_unique<std::uint32_t[]>(column_capacity * height);
+}
+
+void Spectrogram::start() {
+  m_thread = std::jthread([this](std::stop_token token) { run(token); });
+}
+
+// Samples that don't fit are dropped, which only leaves a gap in the picture
+void Spectrogram::push_samples(float* samples, int num_samples) {
+  m_samples.push_samples(samples, num_samples);
+}
+
+void Spectrogram::run(std::stop_token token) {
+  while (m_samples.pop_samples(m_hop, token)) {
+    // Slide the window along by one hop
+    std::copy(m_window.begin() + hop_size, m_window.end(), m_window.begin());
+    std::copy(m_hop.begin(), m_hop.end(), m_window.end() - hop_size);
+
+    for (size_t i = 0; i < fft_size; i++)
+      m_windowed[i] = m_window[i] * m_hann[i];
+    m_fft.power_spectrum(m_windowed, m_power);
+    write_column();
+  }
+}
+
+void Spectrogram::write_column() {
+  // A full scale sine reaches fft_size / 4 through a Hann window
+  const float reference = (fft_size / 4.0f) * (fft_size / 4.0f);
+  const size_t bins_per_row = m_power.size() / height;
+
+  std::uint64_t written = m_written.load(std::memory_order_relaxed);
+  std::uint32_t* column = &m_columns[(written % column_capacity) * height];
+  for (size_t row = 0; row < height; row++) {
+    const float* bins = &m_power[row * bins_per_row];
+    float power = *std::max_element(bins, bins + bins_per_row);
+    float db = 10 * std::log10(power / reference + 1e-12f);
+
+    float position = (db - floor_db) / (top_db - floor_db);
+    column[height - 1 - row] = m_palette[(int)(std::clamp(position, 0.0f, 1.0f) * 255)];
+  }
+  m_written.store(written + 1, std::memory_order_release);
+}
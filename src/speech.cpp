@@ -1,15 +1,259 @@
+#include <SDL3/SDL_log.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#include "error.h"
 #include "speech.h"
 
-SpeechToText::SpeechToText(ModelPaths paths) {
+// Model file paths, which need to outlive the sherpa-onnx config pointing to them
+struct ModelFiles {
+  std::string encoder;
+  std::string decoder;
+  std::string joiner;
+};
+
+static SherpaOnnxOnlineRecognizerConfig make_config(ModelPaths paths,
+                                                    const RecognizerConfig& settings,
+                                                    ModelFiles& files) {
+  files.encoder = settings.int8 ? int8_variant(paths.encoder) : paths.encoder;
+  files.decoder = settings.int8 ? int8_variant(paths.decoder) : paths.decoder;
+  files.joiner = settings.int8 ? int8_variant(paths.joiner) : paths.joiner;
+
+  SherpaOnnxOnlineRecognizerConfig config = {0};
+  config.model_config.debug = 0;
+  config.model_config.num_threads =
+      std::min(settings.threads, (int)std::thread::hardware_concurrency());
+  config.model_config.provider = settings.provider.c_str();
+  config.model_config.tokens = paths.tokens;
+  config.model_config.transducer.encoder = files.encoder.c_str();
+  config.model_config.transducer.decoder = files.decoder.c_str();
+  config.model_config.transducer.joiner = files.joiner.c_str();
+
+  config.max_active_paths = settings.max_active_paths;
+  config.decoding_method = settings.decoding_method.c_str();
+  config.feat_config.sample_rate = 16000;
+  config.feat_config.feature_dim = 80;
+
+  config.enable_endpoint = true;
+  config.rule1_min_trailing_silence = settings.rule1_min_trailing_silence;
+  config.rule2_min_trailing_silence = settings.rule2_min_trailing_silence;
+  config.rule3_min_utterance_length = settings.rule3_min_utterance_length;
+  return config;
+}
+
+// Time how long a few seconds of audio take to decode, relative to their length
+static double measure_real_time_factor(const SherpaOnnxOnlineRecognizer* recognizer) {
+  // Quiet noise is enough, the encoder costs the same whatever the audio is
+  std::vector<float> audio(16000 * 4);
+  unsigned int seed = 1;
+  for (float& sample : audio) {
+    seed = seed * 1664525 + 1013904223;
+    sample = ((seed >> 9) / 8388608.0f - 1.0f) * 0.01f;
+  }
+
+  const SherpaOnnxOnlineStream* stream = SherpaOnnxCreateOnlineStream(recognizer);
+  auto start = std::chrono::steady_clock::now();
+  SherpaOnnxOnlineStreamAcceptWaveform(stream, 16000, audio.data(), audio.size());
+  SherpaOnnxOnlineStreamInputFinished(stream);
+  while (SherpaOnnxIsOnlineStreamReady(recognizer, stream))
+    SherpaOnnxDecodeOnlineStream(recognizer, stream);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  SherpaOnnxDestroyOnlineStream(stream);
+
+  return elapsed.count() / 4.0;
+}
+
+// Captured audio piles up in the sample queue while the model loads, and it only
+// holds about 11 s at 48 kHz. Auto tuning stops trying settings after this long
+// so the queue doesn't overflow
+static constexpr std::chrono::seconds tuning_budget(5);
+
+// Try a few thread counts and decoding methods, and return the recognizer that
+// decodes fastest. `settings` is updated to match it. The configured settings
+// are tried first, so they're used if the budget runs out
+static RecognizerHandle auto_tune(ModelPaths paths, RecognizerConfig& settings,
+                                  ModelLoad& load) {
+  std::vector<RecognizerConfig> candidates = {settings};
+  int max_threads = std::max((int)std::thread::hardware_concurrency(), 1);
+  for (int threads : {1, 2, 4}) {
+    if (threads > max_threads)
+      break;
+    for (const char* method : {"modified_beam_search", "greedy_search"}) {
+      RecognizerConfig candidate = settings;
+      candidate.threads = threads;
+      candidate.decoding_method = method;
+      if (threads != settings.threads || method != settings.decoding_method)
+        candidates.push_back(candidate);
+    }
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  RecognizerHandle best;
+  double best_rtf = 0;
+  size_t tried = 0;
+  for (size_t i = 0; i < candidates.size(); i++) {
+    if (load.abandoned)
+      break;
+    if (best && std::chrono::steady_clock::now() - start > tuning_budget)
+      break;
+
+    ModelFiles files;
+    SherpaOnnxOnlineRecognizerConfig config = make_config(paths, candidates[i], files);
+    RecognizerHandle recognizer = acquire_recognizer(config);
+    load.progress = 0.05f + 0.9f * (i + 1) / candidates.size();
+    tried++;
+    if (!recognizer)
+      continue;
+
+    double rtf = measure_real_time_factor(recognizer.get());
+    if (!best || rtf < best_rtf) {
+      best = recognizer;
+      best_rtf = rtf;
+      settings = candidates[i];
+    }
+  }
+
+  if (best && best_rtf >= 1.0) {
+    SDL_Log("Warning: none of the %zu settings tried decode in real time (best real "
+            "time factor: %.2f), so the transcript will fall behind",
+            tried, best_rtf);
+  }
+  return best;
+}
+
+const char* decode_mode_name(DecodeMode mode) {
+  switch (mode) {
+  case DecodeMode::Configured:
+    return "configured";
+  case DecodeMode::ReducedBeam:
+    return "reduced beam";
+  case DecodeMode::Greedy:
+    return "greedy";
+  }
+  return "unknown";
+}
+
+// The modes to fall back on when decoding can't keep up, starting with the
+// configured one that was already loaded
+static std::shared_ptr<DecodeModes> make_decode_modes(const RecognizerConfig& settings,
+                                                      RecognizerHandle recognizer) {
+  auto modes = std::make_shared<DecodeModes>();
+  modes->modes.push_back(DecodeMode::Configured);
+  modes->configs.push_back(settings);
+  modes->recognizers.push_back(recognizer);
+  if (!settings.adaptive || settings.decoding_method == "greedy_search")
+    return modes;
+
+  if (settings.max_active_paths > 2) {
+    RecognizerConfig reduced = settings;
+    reduced.max_active_paths = settings.max_active_paths / 2;
+    modes->modes.push_back(DecodeMode::ReducedBeam);
+    modes->configs.push_back(reduced);
+  }
+
+  RecognizerConfig greedy = settings;
+  greedy.decoding_method = "greedy_search";
+  modes->modes.push_back(DecodeMode::Greedy);
+  modes->configs.push_back(greedy);
+
+  modes->recognizers.resize(modes->modes.size());
+  return modes;
+}
+
+// Load the recognizers for the cheaper decode modes. Runs on a thread of its
+// own once the live stream is decoding, so it doesn't delay the first transcript.
+// Checks for abandonment before each one, since building one can't be interrupted
+static void load_decode_modes(DecodeModes& modes, ModelPaths paths, ModelLoad& load) {
+  for (size_t i = 1; i < modes.modes.size() && !load.abandoned; i++) {
+    ModelFiles files;
+    RecognizerHandle recognizer =
+        acquire_recognizer(make_config(paths, modes.configs[i], files));
+
+    std::lock_guard<std::mutex> guard(modes.mutex);
+    modes.recognizers[i] = recognizer;
+  }
+}
+
+// Runs on its own thread, so it only touches the shared load state
+static void load_model(std::shared_ptr<ModelLoad> load, ModelPaths paths,
+                       RecognizerConfig settings) {
+  // Creating the recognizer is what takes most of the time, unless another
+  // instance already loaded the same model
+  ReNameNoiseDenoiseState* denoiser = renamenoise_create(nullptr);
+  load->progress = 0.05f;
+
+  RecognizerHandle recognizer;
+  if (settings.auto_tune) {
+    recognizer = auto_tune(paths, settings, *load);
+  } else if (!load->abandoned) {
+    ModelFiles files;
+    recognizer = acquire_recognizer(make_config(paths, settings, files));
+  }
+
+  load->progress = 0.95f;
+  const SherpaOnnxOnlineStream* stream =
+      recognizer ? SherpaOnnxCreateOnlineStream(recognizer.get()) : nullptr;
+  load->progress = 1.0f;
+
+  std::lock_guard<std::mutex> guard(load->mutex);
+  if (load->abandoned || !recognizer) {
+    if (stream)
+      SherpaOnnxDestroyOnlineStream(stream);
+    renamenoise_destroy(denoiser);
+
+    if (!load->abandoned)
+      load->state = ModelState::Failed;
+  } else {
+    load->denoiser = denoiser;
+    load->recognizer = recognizer;
+    load->modes = make_decode_modes(settings, recognizer);
+    load->stream = stream;
+    load->settings = settings;
+    load->state = ModelState::Ready;
+  }
+  load->done.notify_all();
+}
+
+SpeechToText::SpeechToText(ModelPaths paths, RecognizerConfig config) {
   m_model_paths = paths;
+  m_config = config;
   m_initialized = false;
+  m_load = std::make_shared<ModelLoad>();
+  m_force_endpoint = false;
+  m_token_count = 0;
+  m_samples_fed = 0;
+  m_stream_offset = 0;
+  m_accepted_samples = 0;
+  m_decode_nanoseconds = 0;
+  m_mode_index = 0;
+  m_mode = DecodeMode::Configured;
+  m_average_rtf = -1;
+  m_backlog_seconds = 0;
+  m_undecoded_samples = 0;
+  m_last_switch = std::chrono::steady_clock::now();
+  m_preload_started = false;
 }
 
 SpeechToText::~SpeechToText() {
+  {
+    // Leave an unfinished load to clean up after itself, instead of waiting for
+    // it. Also stops preloading decode modes nobody will switch to anymore
+    std::lock_guard<std::mutex> guard(m_load->mutex);
+    m_load->abandoned = true;
+    if (m_load->state == ModelState::Loading) {
+      m_load->state = ModelState::Cancelled;
+      m_load->done.notify_all();
+    } else {
+      adopt_model(); // Take ownership of a finished load nobody waited for
+    }
+  }
+
   if (m_initialized) {
     SherpaOnnxOnlineStreamInputFinished(m_stream);
     SherpaOnnxDestroyOnlineStream(m_stream);
-    SherpaOnnxDestroyOnlineRecognizer(m_recognizer);
     renamenoise_destroy(m_denoiser);
   }
 }
@@ -18,30 +262,103 @@ int SpeechToText::expected_chunk_size() { return renamenoise_get_frame_size(); }
 
 bool SpeechToText::initialized() { return m_initialized; }
 
-void SpeechToText::init() {
-  SherpaOnnxOnlineRecognizerConfig config = {0};
-  config.model_config.debug = 0;
-  config.model_config.num_threads = std::min(2, (int)std::thread::hardware_concurrency());
-  config.model_config.provider = "cpu";
-  config.model_config.tokens = m_model_paths.tokens;
-  config.model_config.transducer.encoder = m_model_paths.encoder;
-  config.model_config.transducer.decoder = m_model_paths.decoder;
-  config.model_config.transducer.joiner = m_model_paths.joiner;
-
-  config.max_active_paths = 4;
-  config.decoding_method = "modified_beam_search";
-  config.feat_config.sample_rate = 16000;
-  config.feat_config.feature_dim = 80;
+// Load the model on the calling thread. Throws if it couldn't be loaded
+void SpeechToText::load() {
+  start_loading();
+  if (!wait_until_loaded({}))
+    throw Error("Failed to load the speech to text model");
+}
 
-  config.enable_endpoint = true;
-  config.rule1_min_trailing_silence = 2.4;
-  config.rule2_min_trailing_silence = 1.2;
-  config.rule3_min_utterance_length = 300;
+// Start loading the model on a background thread. Does nothing if a load was
+// already started
+void SpeechToText::start_loading() {
+  {
+    std::lock_guard<std::mutex> guard(m_load->mutex);
+    if (m_load->state != ModelState::Idle)
+      return;
+    m_load->state = ModelState::Loading;
+  }
 
-  m_recognizer = SherpaOnnxCreateOnlineRecognizer(&config);
-  m_stream = SherpaOnnxCreateOnlineStream(m_recognizer);
-  m_denoiser = renamenoise_create(nullptr);
-  m_initialized = true;
+  // Joining would make shutdown wait for the load to finish. Instead, the
+  // thread is counted until it's done with everything, see model_threads()
+  begin_model_thread();
+  std::thread loader(
+      [load = m_load, paths = m_model_paths, config = m_config]() mutable {
+        load_model(std::move(load), paths, config);
+        end_model_thread();
+      });
+  loader.detach();
+}
+
+// Start loading the recognizers for the cheaper decode modes in the background.
+// Only the live stream switches modes, so nothing else pays for building them
+void SpeechToText::start_preloading() {
+  if (m_preload_started || !m_modes || m_modes->modes.size() < 2)
+    return;
+  m_preload_started = true;
+
+  begin_model_thread();
+  std::thread preloader([load = m_load, modes = m_modes, paths = m_model_paths] {
+    load_decode_modes(*modes, paths, *load);
+    end_model_thread();
+  });
+  preloader.detach();
+}
+
+// Block until the model is ready. Returns false if loading failed, was
+// cancelled, or a stop was requested while waiting
+bool SpeechToText::wait_until_loaded(std::stop_token token) {
+  if (m_initialized)
+    return true;
+
+  std::unique_lock<std::mutex> guard(m_load->mutex);
+  auto lambda = [&] {
+    return m_load->state != ModelState::Idle && m_load->state != ModelState::Loading;
+  };
+  if (!m_load->done.wait(guard, token, lambda))
+    return false; // A stop was requested
+  return adopt_model();
+}
+
+ModelState SpeechToText::model_state() {
+  std::lock_guard<std::mutex> guard(m_load->mutex);
+  return m_load->state;
+}
+
+// Rough fraction of the model that has been loaded, from 0 to 1
+float SpeechToText::load_progress() { return m_load->progress; }
+
+// The loaded recognizer, which can be shared by any number of streams. Holding
+// the handle keeps it alive after this instance is gone
+RecognizerHandle SpeechToText::recognizer() { return m_recognizer_handle; }
+
+// Use a fixed number of threads for each decode, overriding auto tuning. Only
+// takes effect if set before the model is loaded
+void SpeechToText::set_num_threads(int num_threads) {
+  m_config.threads = num_threads;
+  m_config.auto_tune = false;
+}
+
+// The recognizer settings in use. After auto tuning, these are the ones it picked
+RecognizerConfig SpeechToText::config() {
+  std::lock_guard<std::mutex> guard(m_load->mutex);
+  return m_load->state == ModelState::Ready ? m_load->settings : m_config;
+}
+
+// Take ownership of what the loader created. NOTE: The caller must hold the lock
+bool SpeechToText::adopt_model() {
+  if (m_load->state != ModelState::Ready)
+    return false;
+
+  if (!m_initialized) {
+    m_denoiser = m_load->denoiser;
+    m_recognizer_handle = m_load->recognizer;
+    m_recognizer = m_recognizer_handle.get();
+    m_stream = m_load->stream;
+    m_modes = m_load->modes;
+    m_initialized = true;
+  }
+  return true;
 }
 
 std::vector<float> SpeechToText::denoise(float* samples, int num_samples) {
@@ -50,44 +367,275 @@ std::vector<float> SpeechToText::denoise(float* samples, int num_samples) {
   return output;
 }
 
+// Denoise a frame of expected_chunk_size() samples into a caller provided buffer
+void SpeechToText::denoise(std::span<float> samples, std::span<float> output) {
+  renamenoise_process_frame(m_denoiser, output.data(), samples.data());
+}
+
+// Transcribe a self contained piece of audio (16 kHz) on a stream of its own,
+// appending a line per utterance. Safe to call from several threads at once,
+// since the recognizer is shared but the streams aren't
+void SpeechToText::transcribe_segment(std::span<const float> samples,
+                                      std::vector<std::string>& lines) {
+  load();
+  // The base recognizer, since the live stream's one can change between modes
+  const SherpaOnnxOnlineRecognizer* recognizer = m_recognizer_handle.get();
+  const SherpaOnnxOnlineStream* stream = SherpaOnnxCreateOnlineStream(recognizer);
+
+  auto commit = [&] {
+    const SherpaOnnxOnlineRecognizerResult* r =
+        SherpaOnnxGetOnlineStreamResult(recognizer, stream);
+    if (r->text[0] != '\0')
+      lines.push_back(r->text);
+    SherpaOnnxDestroyOnlineRecognizerResult(r);
+    SherpaOnnxOnlineStreamReset(recognizer, stream);
+  };
+
+  // Feed the audio in small pieces so endpoints split it into lines
+  const size_t chunk_size = 1600;
+  for (size_t i = 0; i < samples.size(); i += chunk_size) {
+    size_t length = std::min(chunk_size, samples.size() - i);
+    SherpaOnnxOnlineStreamAcceptWaveform(stream, 16000, samples.data() + i, length);
+
+    while (SherpaOnnxIsOnlineStreamReady(recognizer, stream))
+      SherpaOnnxDecodeOnlineStream(recognizer, stream);
+    if (SherpaOnnxOnlineStreamIsEndpoint(recognizer, stream))
+      commit();
+  }
+
+  SherpaOnnxOnlineStreamInputFinished(stream);
+  while (SherpaOnnxIsOnlineStreamReady(recognizer, stream))
+    SherpaOnnxDecodeOnlineStream(recognizer, stream);
+  commit();
+
+  SherpaOnnxDestroyOnlineStream(stream);
+}
+
 // NOTE: The samples must be normalized to a range of [-1, 1]
-void SpeechToText::process(float* samples, int num_samples) {
+void SpeechToText::process(const float* samples, int num_samples) {
   std::lock_guard<std::mutex> guard(m_mutex);
   SherpaOnnxOnlineStreamAcceptWaveform(m_stream, 16000, samples, num_samples);
+  m_accepted_samples += num_samples;
+  m_undecoded_samples += num_samples;
+  m_samples_fed += num_samples;
   m_have_enough_data.notify_one();
 }
 
-void SpeechToText::run_inference(std::stop_token token, TextHandler handler,
+// Commit the current utterance once the decoder has caught up, even though the
+// endpoint rules haven't fired. Used when silence is gated out before it
+// reaches the recognizer, since the rules depend on seeing trailing silence
+void SpeechToText::end_utterance() {
+  // A bit of silence flushes the last frames through the model's right context
+  static const std::vector<float> tail_padding(16000 * 3 / 10, 0.0f);
+
+  std::lock_guard<std::mutex> guard(m_mutex);
+  SherpaOnnxOnlineStreamAcceptWaveform(m_stream, 16000, tail_padding.data(),
+                                       tail_padding.size());
+  m_undecoded_samples += tail_padding.size();
+  m_samples_fed += tail_padding.size();
+  m_force_endpoint = true;
+  m_have_enough_data.notify_one();
+}
+
+// Samples (at 16 kHz) fed to the live stream so far, including the padding added
+// by end_utterance(). Token times are relative to this
+unsigned long long SpeechToText::samples_fed() { return m_samples_fed; }
+
+// Seconds of CPU (wall) time spent decoding per second of audio accepted
+double SpeechToText::decode_cost() {
+  double audio_seconds = m_accepted_samples / 16000.0;
+  return audio_seconds > 0 ? m_decode_nanoseconds / 1e9 / audio_seconds : 0;
+}
+
+void SpeechToText::run_inference(std::stop_token token, DeltaHandler handler,
                                  void* user_data) {
-  if (!m_initialized)
-    init();
+  start_loading();
+  if (!wait_until_loaded(token))
+    return; // Stopped (or failed) before the model was ready
+  start_preloading();
 
   while (!token.stop_requested()) {
     // Wait until there's enough samples to run inference on
     std::unique_lock<std::mutex> guard(m_mutex);
     auto lambda = [&] {
-      return SherpaOnnxIsOnlineStreamReady(m_recognizer, m_stream) ||
+      return SherpaOnnxIsOnlineStreamReady(m_recognizer, m_stream) || m_force_endpoint ||
              token.stop_requested();
     };
     if (!m_have_enough_data.wait(guard, token, lambda))
       break; // A stop was requested
 
-    while (SherpaOnnxIsOnlineStreamReady(m_recognizer, m_stream)) {
-      if (token.stop_requested())
-        break;
-      SherpaOnnxDecodeOnlineStream(m_recognizer, m_stream);
-    }
+    // The stream was just reset at an endpoint, so this is the only point where
+    // it can be swapped for one on another recognizer without losing part of an
+    // utterance. Offline decoding runs as fast as it can, so it never adapts
+    if (decode_ready(token, handler, user_data))
+      adapt_decode_mode();
+  }
+}
 
-    const SherpaOnnxOnlineRecognizerResult* r =
-        SherpaOnnxGetOnlineStreamResult(m_recognizer, m_stream);
+// Decode whatever is ready without waiting for more audio. Used when the
+// caller feeds the samples itself, e.g. when transcribing a file offline
+void SpeechToText::decode(DeltaHandler handler, void* user_data) {
+  load();
+  std::lock_guard<std::mutex> guard(m_mutex);
+  if (SherpaOnnxIsOnlineStreamReady(m_recognizer, m_stream) || m_force_endpoint)
+    decode_ready({}, handler, user_data);
+}
 
-    bool endpoint = false;
-    if (SherpaOnnxOnlineStreamIsEndpoint(m_recognizer, m_stream)) {
-      SherpaOnnxOnlineStreamReset(m_recognizer, m_stream);
-      endpoint = true;
-    }
+// Signal that no more audio is coming, then decode and commit the remainder
+void SpeechToText::finish(DeltaHandler handler, void* user_data) {
+  load();
+  std::lock_guard<std::mutex> guard(m_mutex);
+  SherpaOnnxOnlineStreamInputFinished(m_stream);
+  while (SherpaOnnxIsOnlineStreamReady(m_recognizer, m_stream))
+    SherpaOnnxDecodeOnlineStream(m_recognizer, m_stream);
 
-    handler(user_data, r->text, endpoint);
-    SherpaOnnxDestroyOnlineRecognizerResult(r);
+  const SherpaOnnxOnlineRecognizerResult* r =
+      SherpaOnnxGetOnlineStreamResult(m_recognizer, m_stream);
+  send_delta(r, true, handler, user_data);
+  SherpaOnnxDestroyOnlineRecognizerResult(r);
+  SherpaOnnxOnlineStreamReset(m_recognizer, m_stream);
+}
+
+// Returns true if the utterance ended. NOTE: The caller must hold m_mutex
+bool SpeechToText::decode_ready(std::stop_token token, DeltaHandler handler,
+                                void* user_data) {
+  double audio_seconds = m_undecoded_samples / 16000.0;
+  m_undecoded_samples = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  while (SherpaOnnxIsOnlineStreamReady(m_recognizer, m_stream)) {
+    if (token.stop_requested())
+      break;
+    SherpaOnnxDecodeOnlineStream(m_recognizer, m_stream);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  m_decode_nanoseconds +=
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+  track_load(std::chrono::duration<double>(elapsed).count(), audio_seconds);
+
+  const SherpaOnnxOnlineRecognizerResult* r =
+      SherpaOnnxGetOnlineStreamResult(m_recognizer, m_stream);
+
+  // A forced endpoint only counts once everything before it has been decoded
+  bool forced =
+      m_force_endpoint && !SherpaOnnxIsOnlineStreamReady(m_recognizer, m_stream);
+  bool endpoint = false;
+  if (forced || SherpaOnnxOnlineStreamIsEndpoint(m_recognizer, m_stream)) {
+    SherpaOnnxOnlineStreamReset(m_recognizer, m_stream);
+    m_force_endpoint = false;
+    endpoint = true;
+  }
+
+  send_delta(r, endpoint, handler, user_data);
+  SherpaOnnxDestroyOnlineRecognizerResult(r);
+  return endpoint;
+}
+
+// Where the result's utterance starts in the stream, in seconds. Only available
+// from the JSON form of the result
+static double start_time(const SherpaOnnxOnlineRecognizerResult* result) {
+  const char* key = result->json ? std::strstr(result->json, "\"start_time\":") : nullptr;
+  return key ? std::strtod(key + std::strlen("\"start_time\":"), nullptr) : 0.0;
+}
+
+// Compare the result's tokens with the ones sent last time, and pass on what
+// changed. NOTE: The caller must hold m_mutex
+void SpeechToText::send_delta(const SherpaOnnxOnlineRecognizerResult* result,
+                              bool endpoint, DeltaHandler handler, void* user_data) {
+  size_t count = result->count;
+  size_t first = 0;
+  while (first < count && first < m_token_count &&
+         m_tokens[first] == result->tokens_arr[first])
+    first++;
+
+  if (first < count || count != m_token_count || endpoint) {
+    TokenDelta delta;
+    delta.first_changed = first;
+    if (count > first)
+      delta.tokens = {result->tokens_arr + first, count - first};
+    if (count > first && result->timestamps)
+      delta.timestamps = {result->timestamps + first, count - first};
+    delta.start_time = m_stream_offset / 16000.0 + start_time(result);
+    delta.endpoint = endpoint;
+    handler(user_data, delta);
+  }
+
+  if (endpoint) {
+    m_token_count = 0;
+    return;
   }
-}
\ No newline at end of file
+
+  // Tokens are a few bytes long, so assigning them doesn't allocate
+  if (m_tokens.size() < count)
+    m_tokens.resize(count);
+  for (size_t i = first; i < count; i++)
+    m_tokens[i] = result->tokens_arr[i];
+  m_token_count = count;
+}
+
+// NOTE: The caller must hold m_mutex
+void SpeechToText::track_load(double decode_seconds, double audio_seconds) {
+  m_backlog_seconds = audio_seconds;
+  if (audio_seconds <= 0)
+    return;
+
+  double rtf = decode_seconds / audio_seconds;
+  m_average_rtf = m_average_rtf < 0 ? rtf : m_average_rtf * 0.9 + rtf * 0.1;
+}
+
+// Move one step down the ladder of decode modes when decoding can't keep up with
+// the audio, and back up once there's plenty of headroom again. The gap between
+// the thresholds and the minimum time between switches keep it from flapping.
+// NOTE: The caller must hold m_mutex
+void SpeechToText::adapt_decode_mode() {
+  if (!m_modes || m_modes->modes.size() < 2 || m_average_rtf < 0)
+    return;
+
+  auto now = std::chrono::steady_clock::now();
+  if (now - m_last_switch < std::chrono::seconds(10))
+    return;
+
+  size_t target = m_mode_index;
+  bool behind = m_average_rtf > 0.8 || m_backlog_seconds > 1.5;
+  bool headroom = m_average_rtf < 0.35 && m_backlog_seconds < 0.5;
+  if (behind && m_mode_index + 1 < m_modes->modes.size())
+    target = m_mode_index + 1;
+  else if (headroom && m_mode_index > 0)
+    target = m_mode_index - 1;
+  if (target == m_mode_index)
+    return;
+
+  // Keep decoding in the current mode if the other one hasn't been preloaded yet
+  RecognizerHandle recognizer;
+  {
+    std::lock_guard<std::mutex> guard(m_modes->mutex);
+    recognizer = m_modes->recognizers[target];
+  }
+
+  // The handle stays alive in m_modes, so the raw pointer can be kept
+  if (recognizer)
+    switch_decode_mode(target, recognizer.get());
+}
+
+// NOTE: The caller must hold m_mutex
+void SpeechToText::switch_decode_mode(size_t index,
+                                      const SherpaOnnxOnlineRecognizer* recognizer) {
+  SDL_Log("Switching from %s to %s decoding (real time factor: %.2f, backlog: %.1fs)",
+          decode_mode_name(m_modes->modes[m_mode_index]),
+          decode_mode_name(m_modes->modes[index]), m_average_rtf, m_backlog_seconds);
+
+  // Streams belong to a recognizer, so the stream has to be replaced too. Audio
+  // it hadn't decoded yet is less than a chunk of trailing silence
+  SherpaOnnxDestroyOnlineStream(m_stream);
+  m_recognizer = recognizer;
+  m_stream = SherpaOnnxCreateOnlineStream(m_recognizer);
+  m_stream_offset = m_samples_fed;
+
+  m_mode_index = index;
+  m_mode = m_modes->modes[index];
+  m_average_rtf = -1; // The new mode has a different cost
+  m_last_switch = std::chrono::steady_clock::now();
+}
+
+// The decode mode currently used by the live stream
+DecodeMode SpeechToText::decode_mode() { return m_mode; }
\ No newline at end of file
@@ -0,0 +1,40 @@
+#include <algorithm>
+
+#include "text_cache.h"
+
+TextMeasureCache::TextMeasureCache(size_t capacity)
+    : m_capacity(std::max<size_t>(capacity, 1)) {
+  m_index.reserve(m_capacity);
+}
+
+const MeasuredText& TextMeasureCache::measure(FontCache& font, std::string_view text,
+                                              std::uint16_t font_id,
+                                              std::uint16_t font_size) {
+  Key key = {std::hash<std::string_view>{}(text), font_id, font_size};
+
+  auto found = m_index.find(key);
+  if (found != m_index.end()) {
+    Entry& entry = *found->second;
+    if (entry.text != text) { // A different text with the same hash
+      entry.text = text;
+      entry.measured.size = font.text_size(text, entry.measured.advances);
+    }
+    m_entries.splice(m_entries.begin(), m_entries, found->second);
+    return entry.measured;
+  }
+
+  // Reuse the least recently used entry when full, so its buffers are kept
+  if (m_entries.size() == m_capacity) {
+    m_index.erase(m_entries.back().key);
+    m_entries.splice(m_entries.begin(), m_entries, std::prev(m_entries.end()));
+  } else {
+    m_entries.emplace_front();
+  }
+
+  Entry& entry = m_entries.front();
+  entry.key = key;
+  entry.text = text;
+  entry.measured.size = font.text_size(text, entry.measured.advances);
+  m_index.emplace(key, m_entries.begin());
+  return entry.measured;
+}
@@ -1,96 +1,365 @@
 #include <algorithm>
-#include <cmath>
+#include <chrono>
+#include <string_view>
 
+#include "alloc_counter.h"
+#include "batch.h"
 #include "transcriber.h"
 
-Transcriber::Transcriber(ModelPaths paths, const char* audio_path, bool capture)
-    : m_stt(paths), m_stream(audio_path, capture) {}
+Transcriber::Transcriber(ModelPaths paths, const char* audio_path, StreamMode mode,
+                         RecognizerConfig recognizer_config, VadConfig vad_config)
+    : m_input_samples(0), m_rescore_dropped(0), m_max_amplitude(0),
+      m_input_peak(0), m_clipped_samples(0), m_dc_offset(0),
+      m_pipeline_allocations(0),
+      m_vad(vad_config, 16000), m_stt(paths, recognizer_config),
+      m_stream(audio_path, mode) {
+  m_created = std::chrono::steady_clock::now();
+  m_first_transcript_seconds = -1;
+  m_published_alignment = std::make_shared<const AlignmentIndex>();
+
+  // A file that was summarized before doesn't need to be summarized again
+  m_pyramid = std::make_unique<WaveformPyramid>(m_stream.sample_rate());
+  m_pyramid_path = std::string(audio_path) + ".peaks";
+  m_spectrogram = std::make_unique<Spectrogram>(m_stream.sample_rate());
+  m_pyramid_loaded = mode != StreamMode::Capture &&
+                     m_pyramid->load(m_pyramid_path.c_str(), m_stream.length_in_frames());
+}
 
 Transcriber::~Transcriber() {
   m_inference_thread.request_stop();
   m_stt_thread.request_stop();
 }
 
+// Rescore every finished line with a larger, non-streaming model. Must be
+// called before start()
+void Transcriber::enable_rescoring(ModelPaths offline_paths) {
+  m_history = std::make_unique<AudioHistory>();
+  m_rescorer = std::make_unique<Rescorer>(offline_paths, handle_rescore, this);
+}
+
 void Transcriber::start() {
   auto audio_callback = [](void* user_data, float* samples, u32 num_samples) {
     Transcriber* t = (Transcriber*)user_data;
     t->calculate_amplitude(samples, num_samples);
+    t->m_spectrogram->push_samples(samples, num_samples);
   };
 
-  auto speech_callback = [](void* user_data, std::string text, bool endpoint) {
-    if (text.size() > 0) {
-      Transcriber* t = (Transcriber*)user_data;
-      t->update_transcript(text, endpoint);
-    }
-  };
-
+  // The model takes a while to load, so get that going before anything else
+  m_stt.start_loading();
   m_stream.start(audio_callback, this);
-  m_stream.enable_resampler(16000);
+  m_spectrogram->start();
+  prepare_pipeline();
 
   m_stt_thread =
       std::jthread([this](std::stop_token token) { this->process_audio_stream(token); });
-  m_inference_thread = std::jthread([this, speech_callback](std::stop_token token) {
-    m_stt.run_inference(token, speech_callback, this);
+  m_inference_thread = std::jthread([this](std::stop_token token) {
+    m_stt.run_inference(token, handle_delta, this);
   });
 }
 
-void Transcriber::calculate_amplitude(float* samples, int num_samples) {
-  // Initialize the buffer of amplitudes
-  if (m_amp_buffer.size() == 0) {
-    m_write_offset = 0;
-    m_amp_buffer_size = 1024;
-    m_max_amplitude = 0;
-    m_amp_buffer.resize(m_amp_buffer_size);
+// Transcribe a whole file on the calling thread, without a device, as fast as
+// the CPU allows
+OfflineStats Transcriber::transcribe_offline() {
+  m_stt.load();
+  prepare_pipeline();
+
+  auto start = std::chrono::steady_clock::now();
+  u64 total_frames = 0;
+
+  while (true) {
+    u64 read = m_stream.read_frames(m_frame);
+    if (read == 0)
+      break;
+
+    // The denoiser only works on whole frames, so pad the last one with silence
+    std::fill(m_frame.begin() + read, m_frame.end(), 0.0f);
+    total_frames += read;
+    if (!m_pyramid_loaded)
+      m_pyramid->push_samples(std::span<const float>(m_frame.data(), read));
+
+    m_stt.denoise(m_frame, m_denoised);
+    u64 length = m_stream.resample(m_denoised, m_resampled);
+    feed_recognizer(std::span<const float>(m_resampled.data(), length));
+    m_stt.decode(handle_delta, this);
   }
+  m_stt.finish(handle_delta, this);
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  OfflineStats stats;
+  stats.audio_seconds = (double)total_frames / m_stream.sample_rate();
+  stats.wall_seconds = elapsed.count();
+  stats.real_time_factor =
+      stats.audio_seconds > 0 ? stats.wall_seconds / stats.audio_seconds : 0;
+  return stats;
+}
+
+// Transcribe a whole file by splitting it at quiet points and decoding the
+// pieces on `num_workers` threads. Meant for long recordings
+OfflineStats Transcriber::transcribe_parallel(int num_workers) {
+  // The workers provide the parallelism, so each decode runs on a single thread
+  m_stt.set_num_threads(1);
+  m_stt.load();
+
+  auto start = std::chrono::steady_clock::now();
+  u64 total_frames = 0;
+  u32 rate = m_stream.sample_rate();
+
+  BatchTranscriber batch(m_stt, rate, num_workers);
+  std::vector<float> block(rate);
+  while (true) {
+    u64 read = m_stream.read_frames(block);
+    if (read == 0)
+      break;
+
+    total_frames += read;
+    if (!m_pyramid_loaded)
+      m_pyramid->push_samples(std::span<const float>(block.data(), read));
+    batch.push_samples(std::span<const float>(block.data(), read));
+  }
+
+  for (std::string& line : batch.finish())
+    m_transcript.commit_line(line);
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  OfflineStats stats;
+  stats.audio_seconds = (double)total_frames / rate;
+  stats.wall_seconds = elapsed.count();
+  stats.real_time_factor =
+      stats.audio_seconds > 0 ? stats.wall_seconds / stats.audio_seconds : 0;
+  return stats;
+}
+
+void Transcriber::prepare_pipeline() {
+  m_stream.enable_resampler(16000);
+
+  int chunk_size = m_stt.expected_chunk_size();
+  m_frame.resize(chunk_size);
+  m_denoised.resize(chunk_size);
+  m_resampled.resize(m_stream.resampled_size(chunk_size));
+}
+
+void Transcriber::handle_delta(void* user_data, const TokenDelta& delta) {
+  Transcriber* t = (Transcriber*)user_data;
+  if (!delta.tokens.empty() && t->m_first_transcript_seconds < 0) {
+    auto elapsed = std::chrono::steady_clock::now() - t->m_created;
+    t->m_first_transcript_seconds = std::chrono::duration<double>(elapsed).count();
+  }
+  t->update_transcript(delta);
+}
+
+// Seconds from creating the transcriber to the first recognized text, or a
+// negative value if nothing has been recognized yet
+double Transcriber::time_to_first_transcript() { return m_first_transcript_seconds; }
+
+ModelState Transcriber::model_state() { return m_stt.model_state(); }
+
+float Transcriber::model_load_progress() { return m_stt.load_progress(); }
+
+RecognizerConfig Transcriber::recognizer_config() { return m_stt.config(); }
+
+DecodeMode Transcriber::decode_mode() { return m_stt.decode_mode(); }
+
+// Runs on the audio callback, so it only does one vectorized pass over the
+// samples and some atomic stores
+void Transcriber::calculate_amplitude(float* samples, int num_samples) {
+  AudioLevels levels = analyze_audio(samples, num_samples);
+  float rms_value = levels.rms;
 
-  // Use the Root Mean Square algorithm to get an amplitude from the samplse
-  float square_sum = 0;
-  for (int i = 0; i < num_samples; i++)
-    square_sum += samples[i] * samples[i];
-  float rms_value = std::sqrt(square_sum / (float)num_samples);
+  if (levels.peak > m_input_peak.load(std::memory_order_relaxed))
+    m_input_peak.store(levels.peak, std::memory_order_relaxed);
+  m_clipped_samples.fetch_add(levels.clipped, std::memory_order_relaxed);
+
+  // Smoothed, since a single callback is too short to say much about DC
+  float dc_offset = m_dc_offset.load(std::memory_order_relaxed);
+  m_dc_offset.store(dc_offset * 0.99f + levels.dc_offset * 0.01f,
+                    std::memory_order_relaxed);
 
   if (rms_value > m_max_amplitude)
     m_max_amplitude = rms_value;
-  float normalized = rms_value / m_max_amplitude;
+  float normalized = m_max_amplitude > 0 ? rms_value / m_max_amplitude : 0.0f;
 
-  // Write to the circular buffer
-  m_amp_buffer[m_write_offset] = normalized;
-  m_write_offset = (m_write_offset + 1) % m_amp_buffer_size;
+  m_amplitudes.push(normalized);
 }
 
 void Transcriber::process_audio_stream(std::stop_token token) {
+  // Audio piles up in the queue until the speech-to-text model has loaded
+  if (!m_stt.wait_until_loaded(token))
+    return;
+
   while (!token.stop_requested()) {
-    if (!m_stt.initialized())
-      continue; // Wait for the speech-to-text model to load
+    u64 allocations = thread_allocation_count();
+    if (!m_stream.get_samples(token, m_frame))
+      break; // A stop was requested
 
-    auto samples = m_stream.get_samples(token, m_stt.expected_chunk_size());
-    if (token.stop_requested())
-      break;
+    m_stt.denoise(m_frame, m_denoised);
+    u64 length = m_stream.resample(m_denoised, m_resampled);
+    m_pipeline_allocations += thread_allocation_count() - allocations;
+
+    // Allocates a new chunk every million samples or so, so it isn't counted
+    if (!m_pyramid_loaded)
+      m_pyramid->push_samples(m_frame);
+    feed_recognizer(std::span<const float>(m_resampled.data(), length));
+  }
+}
+
+// Pass the resampled audio through the voice activity detector, so only speech
+// (plus some padding) reaches the recognizer
+void Transcriber::feed_recognizer(std::span<const float> samples) {
+  if (m_history)
+    m_history->push(samples);
+
+  VadResult gated = m_vad.process(samples);
+  m_input_samples += samples.size();
+
+  // What the gate passes on always ends at the current input position
+  if (!gated.samples.empty()) {
+    m_time_map.add(m_stt.samples_fed(), m_input_samples - gated.samples.size(),
+                   gated.samples.size());
+    m_stt.process(gated.samples.data(), gated.samples.size());
+  }
+  if (gated.speech_ended)
+    m_stt.end_utterance();
+}
+
+InputStats Transcriber::input_stats() {
+  InputStats stats;
+  stats.peak = m_input_peak.load(std::memory_order_relaxed);
+  stats.clipped_samples = m_clipped_samples.load(std::memory_order_relaxed);
+  stats.dc_offset = m_dc_offset.load(std::memory_order_relaxed);
+  return stats;
+}
+
+VadStats Transcriber::vad_stats() {
+  VadStats stats;
+  stats.skipped_fraction = m_vad.skipped_fraction();
+  stats.skipped_seconds = (m_vad.total_samples() - m_vad.forwarded_samples()) / 16000.0;
+  stats.cpu_seconds_saved = stats.skipped_seconds * m_stt.decode_cost();
+  return stats;
+}
+
+RescoreStats Transcriber::rescore_stats() {
+  RescoreStats stats = {0, m_rescore_dropped};
+  if (m_rescorer) {
+    stats.rescored_lines = m_rescorer->rescored_lines();
+    stats.dropped_lines += m_rescorer->dropped_jobs();
+  }
+  return stats;
+}
+
+// Heap allocations made by the pop/denoise/resample stages since start(). Only counted
+// when built with DIDACT_COUNT_ALLOCATIONS, and expected to stay at 0
+u64 Transcriber::pipeline_allocations() { return m_pipeline_allocations; }
 
-    if (samples.size() > 0) {
-      auto denoised = m_stt.denoise(samples.data(), samples.size());
-      auto resampled = m_stream.resample(denoised.data(), denoised.size());
-      m_stt.process(resampled.data(), resampled.size());
+// Edit the current line in place: cut it back to the first changed token, then
+// append the new ones
+void Transcriber::update_transcript(const TokenDelta& delta) {
+  size_t first = std::min(delta.first_changed, m_token_offsets.size());
+  if (first < m_token_offsets.size()) {
+    m_current_line.resize(m_token_offsets[first]);
+    m_token_offsets.resize(first);
+    m_token_times.resize(first);
+  }
+
+  for (size_t i = 0; i < delta.tokens.size(); i++) {
+    const char* token = delta.tokens[i];
+    float offset = i < delta.timestamps.size() ? delta.timestamps[i] : 0.0f;
+    m_token_offsets.push_back(m_current_line.size());
+    m_token_times.push_back(delta.start_time + offset);
+
+    // "▁" marks the start of a word
+    std::string_view text = token;
+    if (text.starts_with("\u2581")) {
+      text.remove_prefix(std::string_view("\u2581").size());
+      if (!m_current_line.empty())
+        m_current_line += ' ';
+    }
+    m_current_line += text;
+  }
+
+  if (delta.endpoint) {
+    if (!m_current_line.empty()) {
+      add_alignment();
+      m_transcript.commit_line(m_current_line);
     }
+    m_current_line.clear();
+    m_token_offsets.clear();
+    m_token_times.clear();
+  } else {
+    m_transcript.set_current_line(m_current_line);
   }
 }
 
-void Transcriber::update_transcript(std::string text, bool endpoint) {
-  m_current_line = text;
-  if (endpoint) {
-    m_lines.push_back(m_current_line);
-    m_current_line = "";
+// Queue the audio of the line being committed (16 kHz input positions of its
+// first and last token) for a second pass. Skipped while decoding has fallen
+// back to a cheaper mode, since that means the CPU is already busy
+void Transcriber::submit_rescore(u64 first_token, u64 last_token) {
+  if (m_stt.decode_mode() != DecodeMode::Configured)
+    return;
+
+  std::vector<float> samples;
+  u64 start = first_token > 16000 * 3 / 10 ? first_token - 16000 * 3 / 10 : 0;
+  u64 end = last_token + 16000 * 6 / 10;
+  if (m_history->copy(start, end, samples))
+    m_rescorer->submit(m_transcript.line_count(), std::move(samples));
+  else
+    m_rescore_dropped++;
+}
+
+// Replace a line with its rescored text. Runs on the rescoring worker
+void Transcriber::handle_rescore(void* user_data, size_t line, const char* text) {
+  Transcriber* t = (Transcriber*)user_data;
+  t->m_transcript.replace_line(line, text);
+}
+
+// Index where the tokens of the current line are in the input audio
+void Transcriber::add_alignment() {
+  double rate = m_stream.sample_rate();
+  m_token_starts.clear();
+  for (double time : m_token_times) {
+    u64 input_sample = m_time_map.to_input(time * 16000);
+    m_token_starts.push_back(input_sample * rate / 16000);
+  }
+
+  if (m_rescorer && !m_token_times.empty()) {
+    u64 first = m_time_map.to_input(m_token_times.front() * 16000);
+    u64 last = m_time_map.to_input(m_token_times.back() * 16000);
+    submit_rescore(first, last);
   }
+
+  // Results don't say where the last token ends, so allow a typical word piece
+  u64 start = m_token_starts.empty() ? 0 : m_token_starts.front();
+  u64 end = m_token_starts.empty() ? 0 : m_token_starts.back() + rate * 0.25;
+  m_alignment.add_line(start, end, m_token_starts, m_token_offsets);
+  m_published_alignment.store(std::make_shared<const AlignmentIndex>(m_alignment),
+                              std::memory_order_release);
 }
 
-std::vector<std::string>& Transcriber::get_transcript() { return m_lines; }
+// The latest version of the transcript. Never blocks, and the snapshot stays
+// unchanged while new lines come in
+TranscriptSnapshotPtr Transcriber::get_transcript() { return m_transcript.snapshot(); }
 
-std::vector<float> Transcriber::get_normalized_waveform() {
-  // Copy the oldest data first
-  std::vector<float> amplitudes(m_amp_buffer_size);
-  std::copy(m_amp_buffer.begin() + m_write_offset,
-            m_amp_buffer.begin() + m_amp_buffer_size, amplitudes.begin());
-  std::copy(m_amp_buffer.begin(), m_amp_buffer.begin() + m_write_offset,
-            amplitudes.begin() + (m_amp_buffer_size - m_write_offset));
-  return amplitudes;
+// The index as of the last committed line. Never blocks, and the snapshot stays
+// unchanged while new lines come in. Lines from transcribe_parallel() aren't
+// indexed, since they're decoded without token timestamps being kept
+AlignmentSnapshotPtr Transcriber::get_alignment() {
+  return m_published_alignment.load(std::memory_order_acquire);
 }
+
+// The last `count` amplitudes, oldest first, without copying them. Only valid
+// for the frame it was taken in, see AmplitudeRing
+WaveformView Transcriber::get_waveform(size_t count) { return m_amplitudes.view(count); }
+
+// Min/max/RMS summaries of all the audio so far, at every zoom level. Safe to
+// read while the audio thread adds to it
+const WaveformPyramid& Transcriber::get_waveform_pyramid() { return *m_pyramid; }
+
+// Store the summaries next to the audio file, so opening it again can draw the
+// whole waveform straight away
+bool Transcriber::save_waveform_pyramid() {
+  if (m_pyramid_loaded)
+    return true; // Already there
+  return m_pyramid->save(m_pyramid_path.c_str());
+}
+
+// Spectrum of the audio callbacks, only filled in after start()
+const Spectrogram& Transcriber::get_spectrogram() { return *m_spectrogram; }
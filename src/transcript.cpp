@@ -0,0 +1,82 @@
+#include <algorithm>
+
+#include "transcript.h"
+
+const std::string& TranscriptSnapshot::line(size_t index) const {
+  return blocks[index / Transcript::block_size]->lines[index % Transcript::block_size];
+}
+
+size_t TranscriptSnapshot::first_changed_line(const TranscriptSnapshot& older) const {
+  size_t shared = std::min(blocks.size(), older.blocks.size());
+  size_t block = 0;
+  while (block < shared && blocks[block] == older.blocks[block])
+    block++;
+  return std::min(block * Transcript::block_size, line_count);
+}
+
+Transcript::Transcript() { m_published = std::make_shared<const TranscriptSnapshot>(); }
+
+TranscriptSnapshotPtr Transcript::snapshot() const {
+  return m_published.load(std::memory_order_acquire);
+}
+
+// Called for every change to the hypothesis. Copies the current line and the
+// block pointers, but none of the committed lines themselves
+void Transcript::set_current_line(std::string_view text) {
+  std::lock_guard<std::mutex> guard(m_writer_mutex);
+  TranscriptSnapshotPtr current = m_published.load(std::memory_order_relaxed);
+
+  auto next = std::make_shared<TranscriptSnapshot>(*current);
+  next->version++;
+  next->current_line = text;
+  m_published.store(std::move(next), std::memory_order_release);
+}
+
+void Transcript::commit_line(std::string_view text) {
+  std::lock_guard<std::mutex> guard(m_writer_mutex);
+  TranscriptSnapshotPtr current = m_published.load(std::memory_order_relaxed);
+
+  auto next = std::make_shared<TranscriptSnapshot>(*current);
+  next->version++;
+  next->current_line.clear();
+
+  // Start a new block, or copy the partly filled last one
+  if (next->line_count % block_size == 0) {
+    auto block = std::make_shared<LineBlock>();
+    block->lines.reserve(block_size);
+    block->lines.emplace_back(text);
+    next->blocks.push_back(std::move(block));
+  } else {
+    auto block = std::make_shared<LineBlock>(*next->blocks.back());
+    block->lines.emplace_back(text);
+    next->blocks.back() = std::move(block);
+  }
+  next->line_count++;
+
+  next->document.append(text);
+  next->document.append("\n");
+  m_published.store(std::move(next), std::memory_order_release);
+}
+
+void Transcript::replace_line(size_t index, std::string_view text) {
+  std::lock_guard<std::mutex> guard(m_writer_mutex);
+  TranscriptSnapshotPtr current = m_published.load(std::memory_order_relaxed);
+  if (index >= current->line_count)
+    return;
+
+  auto next = std::make_shared<TranscriptSnapshot>(*current);
+  next->version++;
+
+  LineBlockPtr& slot = next->blocks[index / block_size];
+  auto block = std::make_shared<LineBlock>(*slot);
+  block->lines[index % block_size] = text;
+  slot = std::move(block);
+
+  size_t start = next->document.line_start(index);
+  size_t end = next->document.line_start(index + 1) - 1; // Keep the newline
+  next->document.erase(start, end - start);
+  next->document.insert(start, text);
+  m_published.store(std::move(next), std::memory_order_release);
+}
+
+size_t Transcript::line_count() { return snapshot()->line_count; }
@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <cmath>
+
+#include "vad.h"
+
+VoiceActivityDetector::VoiceActivityDetector(VadConfig config, unsigned int sample_rate) {
+  m_config = config;
+  m_sample_rate = sample_rate;
+  m_noise_floor_db = -60.0f;
+  m_open = false;
+  m_hangover = 0;
+  m_post_padding = config.post_padding_ms * sample_rate / 1000;
+
+  m_pre_roll.resize(std::max(config.pre_padding_ms * sample_rate / 1000, 1u));
+  m_pre_roll_offset = 0;
+  m_pre_roll_size = 0;
+
+  // Room for the pre-roll plus a generous frame, so the steady state never allocates
+  m_output.resize(m_pre_roll.size() + sample_rate / 10);
+
+  m_total_samples = 0;
+  m_forwarded_samples = 0;
+}
+
+bool VoiceActivityDetector::is_speech(std::span<const float> frame) {
+  if (frame.empty())
+    return false;
+
+  float square_sum = 0;
+  int crossings = 0;
+  for (size_t i = 0; i < frame.size(); i++) {
+    square_sum += frame[i] * frame[i];
+    if (i > 0 && (frame[i] >= 0) != (frame[i - 1] >= 0))
+      crossings++;
+  }
+  float energy_db = 10.0f * std::log10(square_sum / frame.size() + 1e-10f);
+  float zero_crossing_rate = (float)crossings / frame.size();
+
+  // The noise floor drops straight down to quiet frames, but only creeps up
+  // (about 1 dB per second), so speech doesn't drag it up with it
+  float rise = 1.0f * frame.size() / m_sample_rate;
+  m_noise_floor_db = std::min(energy_db, m_noise_floor_db + rise);
+
+  float above_floor = energy_db - m_noise_floor_db;
+  if (above_floor > m_config.threshold_db)
+    return true;
+
+  // Fricatives are quiet but noisy, so accept them at a lower energy
+  bool fricative = zero_crossing_rate > 0.25f && zero_crossing_rate < 0.6f;
+  return fricative && above_floor > m_config.threshold_db / 2;
+}
+
+VadResult VoiceActivityDetector::process(std::span<const float> frame) {
+  m_total_samples += frame.size();
+  if (!m_config.enabled) {
+    m_forwarded_samples += frame.size();
+    return {frame, false};
+  }
+
+  bool speech = is_speech(frame);
+  if (speech)
+    m_hangover = m_post_padding;
+
+  if (m_open) {
+    if (!speech) {
+      m_hangover -= (int)frame.size();
+      if (m_hangover <= 0) {
+        m_open = false;
+        remember(frame);
+        return {{}, true};
+      }
+    }
+
+    m_forwarded_samples += frame.size();
+    return {frame, false};
+  }
+
+  if (!speech) {
+    remember(frame);
+    return {{}, false};
+  }
+
+  // Speech just started, so replay the pre-roll before the current frame
+  m_open = true;
+  if (m_output.size() < m_pre_roll.size() + frame.size())
+    m_output.resize(m_pre_roll.size() + frame.size());
+
+  size_t capacity = m_pre_roll.size();
+  size_t start = (m_pre_roll_offset + capacity - m_pre_roll_size) % capacity;
+  for (size_t i = 0; i < m_pre_roll_size; i++)
+    m_output[i] = m_pre_roll[(start + i) % capacity];
+  std::copy(frame.begin(), frame.end(), m_output.begin() + m_pre_roll_size);
+
+  size_t length = m_pre_roll_size + frame.size();
+  m_pre_roll_size = 0;
+  m_forwarded_samples += length;
+  return {std::span<const float>(m_output.data(), length), false};
+}
+
+void VoiceActivityDetector::remember(std::span<const float> frame) {
+  for (float sample : frame) {
+    m_pre_roll[m_pre_roll_offset] = sample;
+    m_pre_roll_offset = (m_pre_roll_offset + 1) % m_pre_roll.size();
+  }
+  m_pre_roll_size = std::min(m_pre_roll_size + frame.size(), m_pre_roll.size());
+}
+
+unsigned long long VoiceActivityDetector::total_samples() { return m_total_samples; }
+
+unsigned long long VoiceActivityDetector::forwarded_samples() { return m_forwarded_samples; }
+
+double VoiceActivityDetector::skipped_fraction() {
+  if (m_total_samples == 0)
+    return 0;
+  return 1.0 - (double)m_forwarded_samples / m_total_samples;
+}
@@ -0,0 +1,224 @@
+#include <cmath>
+#include <fstream>
+
+#include "waveform.h"
+
+static const std::uint32_t pyramid_magic = 0x4b505744; // "DWPK"
+static const std::uint32_t pyramid_version = 2;        // Bump when the layout changes
+
+WaveformLevel::WaveformLevel() {
+  m_chunks = std::make_unique<std::unique_ptr<WaveformBlock[]>[]>(max_chunks);
+}
+
+void WaveformLevel::push(WaveformBlock block) {
+  std::size_t size = m_size.load(std::memory_order_relaxed);
+  if (size == chunk_size * max_chunks)
+    return; // Full, which takes days of audio
+
+  // A new chunk is in place before the size says anything is in it
+  if (size % chunk_size == 0)
+    m_chunks[size / chunk_size] = std::make_unique<WaveformBlock[]>(chunk_size);
+  m_chunks[size / chunk_size][size % chunk_size] = block;
+  m_size.store(size + 1, std::memory_order_release);
+}
+
+static std::int16_t quantize_sample(float value) {
+  return (std::int16_t)std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f);
+}
+
+static std::uint16_t quantize_rms(double value) {
+  return (std::uint16_t)std::lround(std::clamp(value, 0.0, 1.0) * 65535.0);
+}
+
+static double rms_value(const WaveformBlock& block) { return block.rms / 65535.0; }
+
+static WaveformBlock combine(const WaveformBlock& a, const WaveformBlock& b) {
+  double mean_square = (rms_value(a) * rms_value(a) + rms_value(b) * rms_value(b)) / 2;
+  return {std::min(a.min, b.min), std::max(a.max, b.max),
+          quantize_rms(std::sqrt(mean_square))};
+}
+
+WaveformPyramid::WaveformPyramid(std::uint32_t sample_rate, std::uint32_t block_size)
+    : m_sample_rate(sample_rate), m_block_size(std::max<std::uint32_t>(block_size, 1)) {
+  m_levels = std::make_unique<WaveformLevel[]>(max_levels);
+  m_source_samples = 0;
+  m_min = 0;
+  m_max = 0;
+  m_square_sum = 0;
+  m_pending_samples = 0;
+  std::fill(std::begin(m_has_unpaired), std::end(m_has_unpaired), false);
+}
+
+void WaveformPyramid::push_samples(std::span<const float> samples) {
+  m_source_samples.fetch_add(samples.size(), std::memory_order_relaxed);
+  for (float sample : samples) {
+    if (m_pending_samples == 0) {
+      m_min = sample;
+      m_max = sample;
+    }
+    m_min = std::min(m_min, sample);
+    m_max = std::max(m_max, sample);
+    m_square_sum += sample * sample;
+
+    if (++m_pending_samples == m_block_size) {
+      double rms = std::sqrt(m_square_sum / m_block_size);
+      add_block(0, {quantize_sample(m_min), quantize_sample(m_max), quantize_rms(rms)});
+      m_square_sum = 0;
+      m_pending_samples = 0;
+    }
+  }
+}
+
+void WaveformPyramid::add_block(std::size_t level, WaveformBlock block) {
+  m_levels[level].push(block);
+  if (level + 1 == max_levels)
+    return;
+
+  if (m_has_unpaired[level]) {
+    m_has_unpaired[level] = false;
+    add_block(level + 1, combine(m_unpaired[level], block));
+  } else {
+    m_unpaired[level] = block;
+    m_has_unpaired[level] = true;
+  }
+}
+
+// Only whole blocks are counted
+std::uint64_t WaveformPyramid::sample_count() const {
+  return (std::uint64_t)m_levels[0].size() * m_block_size;
+}
+
+// Running min/max/RMS over blocks of different sizes
+struct BlockSummary {
+  std::int16_t min = INT16_MAX;
+  std::int16_t max = INT16_MIN;
+  double square_sum = 0;
+  std::uint64_t samples = 0;
+
+  void add(const WaveformBlock& block, std::uint64_t block_samples) {
+    min = std::min(min, block.min);
+    max = std::max(max, block.max);
+    square_sum += rms_value(block) * rms_value(block) * block_samples;
+    samples += block_samples;
+  }
+};
+
+// Summarize from `start` to `end` using the blocks of `level`. Its newest
+// blocks may still be waiting for their pair below, so whatever is past its
+// end is taken from the level below
+static void summarize_level(const WaveformLevel* levels, std::size_t level,
+                            std::uint64_t block_samples, std::uint64_t start,
+                            std::uint64_t end, BlockSummary& summary) {
+  std::uint64_t available = levels[level].size();
+  std::uint64_t first = start / block_samples;
+  std::uint64_t last = std::max(first + 1, (end + block_samples - 1) / block_samples);
+  for (std::uint64_t i = first; i < std::min(last, available); i++)
+    summary.add(levels[level][i], block_samples);
+
+  std::uint64_t covered = available * block_samples;
+  if (level > 0 && end > covered)
+    summarize_level(levels, level - 1, block_samples / 2, std::max(start, covered), end,
+                    summary);
+}
+
+void WaveformPyramid::summarize(std::uint64_t start, std::uint64_t end,
+                                std::span<WaveformBlock> columns) const {
+  if (columns.empty() || end <= start)
+    return;
+
+  // The coarsest level that still has a block (or more) per column
+  double per_column = (double)(end - start) / columns.size();
+  std::size_t level = 0;
+  while (level + 1 < max_levels &&
+         ((std::uint64_t)m_block_size << (level + 1)) <= per_column)
+    level++;
+  std::uint64_t block_samples = (std::uint64_t)m_block_size << level;
+
+  for (std::size_t i = 0; i < columns.size(); i++) {
+    std::uint64_t column_start = start + (std::uint64_t)(i * per_column);
+    std::uint64_t column_end = start + (std::uint64_t)((i + 1) * per_column);
+
+    BlockSummary summary;
+    summarize_level(m_levels.get(), level, block_samples, column_start,
+                    std::max(column_end, column_start + 1), summary);
+
+    if (summary.samples == 0)
+      columns[i] = {0, 0, 0};
+    else
+      columns[i] = {summary.min, summary.max,
+                    quantize_rms(std::sqrt(summary.square_sum / summary.samples))};
+  }
+}
+
+// Layout: magic, version, sample rate, block size, level count, the number of
+// samples summarized, the number of blocks in each level, then each level's
+// blocks. Native byte order
+bool WaveformPyramid::save(const char* path) const {
+  std::ofstream file(path, std::ios::binary);
+  if (!file)
+    return false;
+
+  std::uint32_t header[] = {pyramid_magic, pyramid_version, m_sample_rate, m_block_size,
+                            (std::uint32_t)max_levels};
+  file.write((const char*)header, sizeof(header));
+  std::uint64_t source_samples = m_source_samples.load(std::memory_order_relaxed);
+  file.write((const char*)&source_samples, sizeof(source_samples));
+
+  // Take the sizes once, so a writer adding blocks meanwhile doesn't matter
+  std::uint64_t counts[max_levels];
+  for (std::size_t level = 0; level < max_levels; level++)
+    counts[level] = m_levels[level].size();
+  file.write((const char*)counts, sizeof(counts));
+
+  for (std::size_t level = 0; level < max_levels; level++) {
+    for (std::uint64_t i = 0; i < counts[level]; i += WaveformLevel::chunk_size) {
+      std::uint64_t length =
+          std::min<std::uint64_t>(WaveformLevel::chunk_size, counts[level] - i);
+      file.write((const char*)&m_levels[level][i], length * sizeof(WaveformBlock));
+    }
+  }
+  return (bool)file;
+}
+
+// NOTE: Not safe to call while other threads are reading the pyramid
+// A pyramid saved before the audio was summarized to the end, or for another
+// file since, has a different sample count and is rejected
+bool WaveformPyramid::load(const char* path, std::uint64_t source_samples) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    return false;
+
+  std::uint32_t header[5];
+  std::uint64_t saved_samples;
+  std::uint64_t counts[max_levels];
+  file.read((char*)header, sizeof(header));
+  file.read((char*)&saved_samples, sizeof(saved_samples));
+  file.read((char*)counts, sizeof(counts));
+  if (!file || header[0] != pyramid_magic || header[1] != pyramid_version ||
+      header[2] != m_sample_rate || header[3] != m_block_size || header[4] != max_levels)
+    return false;
+  if (source_samples == 0 || saved_samples != source_samples)
+    return false;
+
+  auto levels = std::make_unique<WaveformLevel[]>(max_levels);
+  for (std::size_t level = 0; level < max_levels; level++) {
+    for (std::uint64_t i = 0; i < counts[level]; i++) {
+      WaveformBlock block;
+      if (!file.read((char*)&block, sizeof(block)))
+        return false;
+      levels[level].push(block);
+    }
+  }
+
+  // Carry on building from where the saved pyramid stopped
+  m_levels = std::move(levels);
+  m_source_samples = saved_samples;
+  for (std::size_t level = 0; level < max_levels; level++) {
+    m_has_unpaired[level] = counts[level] % 2 == 1;
+    if (m_has_unpaired[level])
+      m_unpaired[level] = m_levels[level][counts[level] - 1];
+  }
+  m_square_sum = 0;
+  m_pending_samples = 0;
+  return true;
+}